@@ -0,0 +1,532 @@
+"""End-to-end benchmark for the podmapper fingerprinting path.
+
+Generates a synthetic episode (talk-like noise alternating with known music,
+with crossfades and voice-over), then runs ``split_wave_file`` ->
+``gnfingerprint`` -> ``trim_tracks`` against a local stand-in for the
+Gracenote backend and reports throughput, resource usage and accuracy.
+
+    python benchmark.py --minutes 60
+    python benchmark.py --minutes 240 --backend inprocess --json bench.json
+    python benchmark.py --backend gnfingerprint --prefetch-depth 0 4
+
+The stand-in backend knows the reference waveform of every synthetic track
+and matches each slice against them with ``audioop.findfit``. In
+``subprocess`` mode (the default) it is installed as a fake ``gnfingerprint``
+executable at the front of $PATH, so the real fork/exec and output parsing in
+``podmapper.fingerprint_files`` are measured too.
+
+The ``gnfingerprint`` backend runs the real program on $PATH instead, to
+compare its input prefetching: each run reports the time the program spent
+waiting for slice files (``io_wait_ms``, from its log) for every
+``--prefetch-depth``. Gracenote doesn't know the synthetic tracks, so its
+accuracy figures are meaningless.
+"""
+import argparse
+import audioop
+import collections
+import json
+import logging
+import math
+import os
+import os.path
+import random
+import re
+import resource
+import shutil
+import stat
+import sys
+import tempfile
+import time
+import wave
+
+
+SAMPLE_RATE = 44100
+SAMPLE_WIDTH = 2
+NUM_CHANNELS = 2
+
+"""Synthetic audio is rendered in blocks of this many frames (100ms)"""
+BLOCK_FRAMES = 4410
+
+"""Peak amplitude of music and talk segments"""
+MUSIC_LEVEL = 9000
+TALK_LEVEL = 6000
+
+"""Voice-over is mixed on top of music at this fraction of TALK_LEVEL"""
+VOICE_OVER_LEVEL = 0.5
+
+"""Minimum seconds a track must be audible to count as played"""
+MIN_PLAYED_SECONDS = 20
+
+"""Stand-in matching: frames per probe, probes per slice and score threshold"""
+STANDIN_PROBE_FRAMES = 1024
+STANDIN_PROBES = 3
+STANDIN_MIN_SCORE = 0.6
+
+STANDIN_DB_ENV = 'PODMAPPER_STANDIN_DB'
+
+"""The prefetch summary gnfingerprint logs when it finishes a batch"""
+IO_WAIT_PATTERN = re.compile(r'msg=input: .*io_wait_ms=([0-9.]+)')
+
+
+class SyntheticTrack(object):
+    """A periodic waveform with a track-specific period and timbre."""
+
+    def __init__(self, index, period, seed):
+        self.index = index
+        self.period = period
+        self.seed = seed
+        self.record = (
+            'Synthetic Artist %02d' % index,
+            'Synthetic Album %02d' % index,
+            'Synthetic Track %02d' % index,
+        )
+
+        rng = random.Random(seed)
+        harmonics = [(n, rng.uniform(0.2, 1.0) / n, rng.uniform(0, 2 * math.pi))
+                     for n in range(1, 7)]
+        norm = sum(amplitude for (n, amplitude, phase) in harmonics)
+        samples = []
+        for i in range(period):
+            value = sum(amplitude * math.sin(2 * math.pi * n * i / period + phase)
+                        for (n, amplitude, phase) in harmonics)
+            samples.append(int(MUSIC_LEVEL * value / norm))
+        self.waveform = _pack(samples)
+
+    def render(self, start_frame, num_frames):
+        """Returns mono PCM for ``num_frames`` starting at ``start_frame``."""
+        offset = start_frame % self.period
+        repeat = (offset + num_frames) // self.period + 1
+        data = self.waveform * repeat
+        return data[offset * SAMPLE_WIDTH:(offset + num_frames) * SAMPLE_WIDTH]
+
+    def to_dict(self):
+        return {'index': self.index, 'period': self.period, 'seed': self.seed}
+
+    @classmethod
+    def from_dict(cls, d):
+        return cls(d['index'], d['period'], d['seed'])
+
+
+class Segment(object):
+    """One entry of an episode's ground truth timeline."""
+
+    def __init__(self, kind, start, end, track=None, fade_in=0, voice_over=0):
+        self.kind = kind  # 'talk' or 'music'
+        self.start = start  # in seconds
+        self.end = end
+        self.track = track
+        self.fade_in = fade_in  # crossfade with the previous segment, seconds
+        self.voice_over = voice_over  # seconds of talk over the start of music
+
+
+def _pack(samples):
+    """Packs signed 16-bit samples into a native-endian byte string."""
+    import array
+    return array.array('h', samples).tostring()
+
+
+def make_tracks(count, seed):
+    """Builds ``count`` tracks with distinct periods between 60 and 400 frames."""
+    rng = random.Random(seed)
+    periods = rng.sample(range(60, 400), count)
+    return [SyntheticTrack(i + 1, period, rng.randint(0, 2 ** 31))
+            for (i, period) in enumerate(periods)]
+
+
+def plan_episode(tracks, minutes, seed, min_track=60, max_track=240,
+                 crossfade=5, voice_over=10):
+    """Lays out alternating talk and music segments covering ``minutes``.
+
+    About half of the music-to-music transitions are crossfaded and about
+    half of the tracks start under a voice-over."""
+    rng = random.Random(seed)
+    total = minutes * 60
+    segments = []
+    position = 0
+    while position < total:
+        if segments and segments[-1].kind == 'music' and rng.random() < 0.5:
+            length = min(rng.randint(min_track, max_track), total - position)
+            fade = min(crossfade, length / 2)
+            start = max(position - fade, 0)
+            segments.append(Segment('music', start, position + length,
+                                    rng.choice(tracks), fade_in=fade))
+        elif not segments or segments[-1].kind == 'music':
+            length = min(rng.randint(20, 90), total - position)
+            segments.append(Segment('talk', position, position + length))
+        else:
+            length = min(rng.randint(min_track, max_track), total - position)
+            over = voice_over if rng.random() < 0.5 else 0
+            segments.append(Segment('music', position, position + length,
+                                    rng.choice(tracks),
+                                    voice_over=min(over, length)))
+        position = segments[-1].end
+    return segments
+
+
+def played_tracks(segments):
+    """Ground truth: the tracks audible for at least MIN_PLAYED_SECONDS."""
+    durations = collections.Counter()
+    for segment in segments:
+        if segment.kind == 'music':
+            durations[segment.track.record] += segment.end - segment.start
+    return set(record for (record, seconds) in durations.items()
+               if seconds >= MIN_PLAYED_SECONDS)
+
+
+class NoisePool(object):
+    """Ten seconds of seeded white noise that talk segments are cut from."""
+
+    def __init__(self, seed):
+        rng = random.Random(seed)
+        self.frames = SAMPLE_RATE * 10
+        self.data = _pack([rng.randint(-32767, 32767) for _ in range(self.frames)])
+        self.rng = rng
+
+    def talk_block(self, num_frames):
+        """Noise with a syllable-like envelope: random gain with pauses."""
+        offset = self.rng.randint(0, self.frames - num_frames)
+        block = self.data[offset * SAMPLE_WIDTH:(offset + num_frames) * SAMPLE_WIDTH]
+        gain = 0.0 if self.rng.random() < 0.2 else self.rng.uniform(0.3, 1.0)
+        return audioop.mul(block, SAMPLE_WIDTH, gain * TALK_LEVEL / 32767.0)
+
+
+def write_episode(path, segments, seed):
+    """Renders ``segments`` to a 44.1kHz 16-bit stereo WAV file at ``path``."""
+
+    logger = logging.getLogger('bench-generator')
+
+    noise = NoisePool(seed)
+    total_frames = int(segments[-1].end * SAMPLE_RATE)
+    silence = '\0' * (BLOCK_FRAMES * SAMPLE_WIDTH)
+
+    episode = wave.open(path, 'w')
+    episode.setnchannels(NUM_CHANNELS)
+    episode.setsampwidth(SAMPLE_WIDTH)
+    episode.setframerate(SAMPLE_RATE)
+
+    first = 0
+    for block_start in range(0, total_frames, BLOCK_FRAMES):
+        num_frames = min(BLOCK_FRAMES, total_frames - block_start)
+        t = float(block_start) / SAMPLE_RATE
+        mix = silence[:num_frames * SAMPLE_WIDTH]
+
+        while segments[first].end <= t:
+            first += 1
+        for segment in segments[first:first + 2]:
+            if not segment.start <= t < segment.end:
+                continue
+            if segment.kind == 'talk':
+                block = noise.talk_block(num_frames)
+            else:
+                block = segment.track.render(block_start, num_frames)
+                if segment.fade_in and t < segment.start + segment.fade_in:
+                    gain = (t - segment.start) / segment.fade_in
+                    block = audioop.mul(block, SAMPLE_WIDTH, gain)
+                if segment.voice_over and t < segment.start + segment.voice_over:
+                    talk = audioop.mul(noise.talk_block(num_frames), SAMPLE_WIDTH,
+                                       VOICE_OVER_LEVEL)
+                    block = audioop.add(block, talk, SAMPLE_WIDTH)
+            following = segments[first + 1] if first + 1 < len(segments) else None
+            if (following is not None and following.fade_in and segment is not following
+                    and t >= following.start):
+                gain = (segment.end - t) / following.fade_in
+                block = audioop.mul(block, SAMPLE_WIDTH, gain)
+            mix = audioop.add(mix, block, SAMPLE_WIDTH)
+
+        episode.writeframes(audioop.tostereo(mix, SAMPLE_WIDTH, 1, 1))
+
+    episode.close()
+    logger.info('Wrote %s (%d frames, %d segments)', path, total_frames,
+                len(segments))
+
+
+class StandInBackend(object):
+    """Identifies slices by matching them against the known track waveforms."""
+
+    def __init__(self, tracks):
+        self.tracks = tracks
+
+    @classmethod
+    def load(cls, db_path):
+        with open(db_path) as fp:
+            return cls([SyntheticTrack.from_dict(d) for d in json.load(fp)])
+
+    @staticmethod
+    def save(tracks, db_path):
+        with open(db_path, 'w') as fp:
+            json.dump([track.to_dict() for track in tracks], fp)
+
+    def _score(self, probe, track):
+        offset, factor = audioop.findfit(probe, track.waveform)
+        part = probe[offset * SAMPLE_WIDTH:offset * SAMPLE_WIDTH + len(track.waveform)]
+        power = audioop.rms(part, SAMPLE_WIDTH)
+        if power == 0:
+            return 0.0
+        residual = audioop.add(part, audioop.mul(track.waveform, SAMPLE_WIDTH, -factor),
+                               SAMPLE_WIDTH)
+        return 1.0 - float(audioop.rms(residual, SAMPLE_WIDTH)) / power
+
+    def identify(self, src_path):
+        """Returns the (artist, album, track) tuple of ``src_path`` or None."""
+        track_slice = wave.open(src_path, 'r')
+        num_frames = track_slice.getnframes()
+        data = audioop.tomono(track_slice.readframes(num_frames), SAMPLE_WIDTH, 0.5, 0.5)
+        track_slice.close()
+
+        if num_frames < STANDIN_PROBE_FRAMES:
+            return None
+
+        votes = collections.Counter()
+        step = (num_frames - STANDIN_PROBE_FRAMES) // STANDIN_PROBES
+        for i in range(STANDIN_PROBES):
+            start = i * step * SAMPLE_WIDTH
+            probe = data[start:start + STANDIN_PROBE_FRAMES * SAMPLE_WIDTH]
+            score, track = max((self._score(probe, track), track) for track in self.tracks)
+            if score >= STANDIN_MIN_SCORE:
+                votes[track.record] += 1
+
+        if votes:
+            record, count = votes.most_common(1)[0]
+            if count * 2 > STANDIN_PROBES:
+                return record
+        return None
+
+
+def standin_main(argv):
+    """Entry point of the fake ``gnfingerprint``; prints what the real one does."""
+    if len(argv) < 4:
+        print '\nUsage:\n%s clientid clientidtag license file [file ...]' % sys.argv[0]
+        return -1
+
+    backend = StandInBackend.load(os.environ[STANDIN_DB_ENV])
+    for src_path in argv[3:]:
+        if len(argv) > 4:
+            print '%16s %s' % ('File:', src_path)
+        record = backend.identify(src_path)
+        if record is None:
+            print '\nNo tracks found for the input.'
+        else:
+            print '%16s' % 'Final track:'
+            for label, value in zip(('Artist:', 'Album:', 'Title:'), record):
+                print '%16s %s' % (label, value)
+    return 0
+
+
+def install_standin(bin_dir, db_path):
+    """Writes a ``gnfingerprint`` wrapper into ``bin_dir`` and puts it on $PATH."""
+    script_path = os.path.join(bin_dir, 'gnfingerprint')
+    with open(script_path, 'w') as fp:
+        fp.write('#!/bin/sh\nexec "%s" "%s" standin "$@"\n' % (
+            sys.executable, os.path.abspath(__file__)))
+    os.chmod(script_path, os.stat(script_path).st_mode | stat.S_IEXEC)
+    os.environ[STANDIN_DB_ENV] = db_path
+    os.environ['PATH'] = bin_dir + os.pathsep + os.environ['PATH']
+
+
+def directory_bytes(path):
+    total = 0
+    for root, dirs, files in os.walk(path):
+        for name in files:
+            total += os.path.getsize(os.path.join(root, name))
+    return total
+
+
+def io_wait_ms(log_dir):
+    """Total input wait logged by the gnfingerprint runs, or None if none logged it."""
+    total = None
+    for name in os.listdir(log_dir):
+        with open(os.path.join(log_dir, name)) as fp:
+            for line in fp:
+                match = IO_WAIT_PATTERN.search(line)
+                if match:
+                    total = (total or 0.0) + float(match.group(1))
+    return total
+
+
+def peak_rss_kb():
+    """Peak resident set size of this process and of its largest child."""
+    return (resource.getrusage(resource.RUSAGE_SELF).ru_maxrss,
+            resource.getrusage(resource.RUSAGE_CHILDREN).ru_maxrss)
+
+
+def run_isolated(func, *args):
+    """Calls ``func(*args)`` in a forked child and returns the report it
+    returns, with the child's peak RSS added. A fresh child per run keeps
+    corpus generation and earlier runs out of the figures."""
+    read_fd, write_fd = os.pipe()
+    pid = os.fork()
+    if pid == 0:
+        os.close(read_fd)
+        status = 0
+        try:
+            report = func(*args)
+            report['peak_rss_kb'], report['peak_child_rss_kb'] = peak_rss_kb()
+            payload = json.dumps(report)
+        except BaseException:
+            logging.getLogger('benchmark').exception('Benchmark run failed')
+            payload, status = '', 1
+        with os.fdopen(write_fd, 'w') as fp:
+            fp.write(payload)
+        os._exit(status)
+
+    os.close(write_fd)
+    with os.fdopen(read_fd) as fp:
+        payload = fp.read()
+    os.waitpid(pid, 0)
+    if not payload:
+        raise RuntimeError('Benchmark run failed')
+    return json.loads(payload, object_pairs_hook=collections.OrderedDict)
+
+
+def accuracy(identified, expected):
+    """Returns (precision, recall) of the ``identified`` track set."""
+    identified = set(identified)
+    hits = len(identified & expected)
+    precision = float(hits) / len(identified) if identified else 1.0
+    recall = float(hits) / len(expected) if expected else 1.0
+    return precision, recall
+
+
+def run_pipeline(episode_path, work_dir, expected, backend, sample_size=None,
+                 filter_count=None):
+    """Runs split -> fingerprint -> trim on ``episode_path`` and measures it.
+
+    ``backend`` is None to go through the ``gnfingerprint`` on $PATH, or an
+    object with an ``identify(path)`` method to stay in-process."""
+    import podmapper
+
+    slice_dir = tempfile.mkdtemp(prefix='slices-', dir=work_dir)
+    log_dir = tempfile.mkdtemp(prefix='logs-')
+    windows = [0]
+    fingerprint_files = podmapper.fingerprint_files
+
+    def counted_fingerprint_files(src_paths):
+        windows[0] += len(src_paths)
+        if backend is None:
+            return fingerprint_files(src_paths)
+        return [backend.identify(src_path) for src_path in src_paths]
+
+    report = collections.OrderedDict()
+    podmapper.fingerprint_files = counted_fingerprint_files
+    in_process = podmapper.gnfingerprint
+    podmapper.gnfingerprint = None  # the stand-in only exists as a program
+    try:
+        started = time.time()
+        podmapper.split_wave_file(episode_path, slice_dir, sample_size)
+        split_done = time.time()
+        report['temp_disk_bytes'] = directory_bytes(work_dir)
+        os.environ['GNFP_LOG_PATH'] = os.path.join(log_dir, 'gnfingerprint-%p.log')
+        os.environ['GNFP_LOG_LEVEL'] = 'info'
+        found_tracks = podmapper.fingerprint_directory(slice_dir)
+        fingerprint_done = time.time()
+        results = podmapper.trim_tracks(found_tracks, filter_count)
+        finished = time.time()
+    finally:
+        podmapper.fingerprint_files = fingerprint_files
+        podmapper.gnfingerprint = in_process
+        shutil.rmtree(slice_dir)
+        wait_ms = io_wait_ms(log_dir)
+        shutil.rmtree(log_dir)
+
+    windows = windows[0]
+    precision, recall = accuracy(results, expected)
+    report['windows'] = windows
+    report['wall_seconds'] = finished - started
+    report['split_seconds'] = split_done - started
+    report['fingerprint_seconds'] = fingerprint_done - split_done
+    report['trim_seconds'] = finished - fingerprint_done
+    report['io_wait_ms'] = wait_ms
+    report['windows_per_second'] = windows / (finished - started) if windows else 0.0
+    report['identified_tracks'] = len(results)
+    report['expected_tracks'] = len(expected)
+    report['precision'] = precision
+    report['recall'] = recall
+    return report
+
+
+def generate_corpus(work_dir, minutes, num_tracks, seed):
+    """Writes a synthetic episode and the stand-in track database to ``work_dir``.
+
+    Returns (episode_path, db_path, tracks, segments)."""
+    tracks = make_tracks(num_tracks, seed)
+    segments = plan_episode(tracks, minutes, seed)
+    episode_path = os.path.join(work_dir, 'episode-%dmin-%d.wav' % (minutes, seed))
+    write_episode(episode_path, segments, seed)
+    db_path = os.path.join(work_dir, 'standin-db.json')
+    StandInBackend.save(tracks, db_path)
+    return episode_path, db_path, tracks, segments
+
+
+def main(argv):
+    parser = argparse.ArgumentParser(description=__doc__.split('\n')[0])
+    parser.add_argument('--minutes', type=int, nargs='+', default=[10],
+                        help='episode lengths to benchmark, in minutes')
+    parser.add_argument('--tracks', type=int, default=20,
+                        help='number of distinct tracks in the corpus')
+    parser.add_argument('--seed', type=int, default=1)
+    parser.add_argument('--backend', choices=('subprocess', 'inprocess', 'gnfingerprint'),
+                        default='subprocess')
+    parser.add_argument('--prefetch-depth', type=int, nargs='+', default=[None],
+                        help='GNFP_PREFETCH_DEPTH values to compare, 0 reads synchronously '
+                        '(default: the program\'s)')
+    parser.add_argument('--sample-size', type=float, default=None,
+                        help='window length in seconds (default: config)')
+    parser.add_argument('--filter-count', type=int, default=None,
+                        help='trim_tracks vote threshold (default: config)')
+    parser.add_argument('--json', help='also write the reports to this file')
+    parser.add_argument('--keep', action='store_true',
+                        help='keep the generated corpus')
+    args = parser.parse_args(argv)
+
+    logger = logging.getLogger('benchmark')
+
+    reports = []
+    for minutes in args.minutes:
+        work_dir = tempfile.mkdtemp(prefix='podmapper-bench-')
+        try:
+            episode_path, db_path, tracks, segments = generate_corpus(
+                work_dir, minutes, args.tracks, args.seed)
+            backend = None
+            if args.backend == 'inprocess':
+                backend = StandInBackend(tracks)
+            elif args.backend == 'subprocess':
+                install_standin(work_dir, db_path)
+
+            for depth in args.prefetch_depth:
+                if depth is None:
+                    os.environ.pop('GNFP_PREFETCH_DEPTH', None)
+                else:
+                    os.environ['GNFP_PREFETCH_DEPTH'] = str(depth)
+
+                report = collections.OrderedDict()
+                report['minutes'] = minutes
+                report['backend'] = args.backend
+                report['prefetch_depth'] = depth
+                report.update(run_isolated(run_pipeline, episode_path, work_dir,
+                                           played_tracks(segments), backend,
+                                           args.sample_size, args.filter_count))
+                reports.append(report)
+
+                for key, value in report.items():
+                    logger.info('%-22s %s', key, value)
+        finally:
+            if args.keep:
+                logger.info('Corpus kept in %s', work_dir)
+            else:
+                shutil.rmtree(work_dir)
+
+    if args.json:
+        with open(args.json, 'w') as fp:
+            json.dump(reports, fp, indent=2)
+
+    return 0
+
+
+if __name__ == '__main__':
+    logging.basicConfig(level=logging.INFO)
+    logging.getLogger('spliter').setLevel(logging.WARN)
+    logging.getLogger('fingerprint').setLevel(logging.WARN)
+
+    if len(sys.argv) > 1 and sys.argv[1] == 'standin':
+        sys.exit(standin_main(sys.argv[2:]))
+    sys.exit(main(sys.argv[1:]))
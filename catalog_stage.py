@@ -0,0 +1,390 @@
+"""Asynchronous Echo Nest / Rdio stage for multi-episode runs.
+
+Episodes are submitted as soon as their tracks are known. Their updates are
+merged into one catalog update call per batch, outstanding tickets are polled
+concurrently with an adaptive interval, and each episode's Rdio playlist is
+created as soon as the ticket of its batch completes.
+
+    stage = CatalogStage()
+    stage.submit(episode_name, tracks, playlist_description)
+    ...
+    playlists = stage.close()  # {episode_name: createPlaylist response}
+
+``python catalog_stage.py`` runs the stage against the in-memory mock
+services below and reports how many remote calls were made.
+"""
+import collections
+import hashlib
+import logging
+import random
+import sys
+import threading
+import time
+from multiprocessing.pool import ThreadPool
+
+import config
+
+
+ITEM_ID_SEPARATOR = '|'
+
+ITEM_PAGE_SIZE = 100  # the most items the catalog API returns per read
+
+
+def _item_id(episode_name, artist, title):
+    """Item IDs carry the episode so a shared catalog can be split up again.
+
+    The episode comes first and a fixed-width hex digest last, so the episode
+    may contain the separator itself."""
+    return '%s%s%s' % (episode_name, ITEM_ID_SEPARATOR,
+                       hashlib.sha1('%s\0%s' % (artist, title)).hexdigest())
+
+
+def _item_episode(item):
+    """Returns the episode an item returned by ``get_item_dicts`` belongs to."""
+    item_id = item.get('request', {}).get('item_id') or item.get('item_id', '')
+    return item_id.rsplit(ITEM_ID_SEPARATOR, 1)[0]
+
+
+def _echo_nest_catalog(name):
+    from pyechonest import catalog as echo_nest_catalog
+    return echo_nest_catalog.Catalog(name, type='song')
+
+
+def _rdio_playlist(playlist_name, playlist_description, found_rdio_tracks):
+    import podmapper
+    return podmapper.create_rdio_playlist(playlist_name, playlist_description,
+                                          found_rdio_tracks)
+
+
+class Batch(object):
+    """Episodes merged into one catalog update, and the state of its ticket."""
+
+    def __init__(self, number, episodes):
+        self.number = number
+        self.episodes = episodes  # [(episode_name, tracks, description)]
+        self.catalog_name = 'podmapper-%d-%d' % (time.time(), number)
+        self.ticket = None
+        self.submitted = None
+        self.interval = config.ECHO_NEST_SLEEP
+        self.next_poll = None
+        self.percent_complete = None
+        self.polling = False
+        self.failures = 0  # consecutive failed polls
+
+
+class CatalogStage(object):
+    """Batches catalog updates, polls tickets and creates playlists.
+
+    ``catalog_factory(name)`` returns an object with the ``update``,
+    ``status`` and ``get_item_dicts`` methods of ``pyechonest.catalog.Catalog``
+    and ``create_playlist(name, description, rdio_track_keys)`` creates an Rdio
+    playlist; both default to the real services."""
+
+    def __init__(self, catalog_factory=None, create_playlist=None, batch_size=None,
+                 batch_wait=None, workers=None):
+        self.catalog_factory = catalog_factory or _echo_nest_catalog
+        self.create_playlist = create_playlist or _rdio_playlist
+        self.batch_size = batch_size or config.ECHO_NEST_BATCH_SIZE
+        self.batch_wait = config.ECHO_NEST_BATCH_WAIT if batch_wait is None else batch_wait
+        self.pool = ThreadPool(workers or config.ECHO_NEST_WORKERS)
+
+        self.logger = logging.getLogger('catalog-stage')
+        self.condition = threading.Condition()
+        self.pending = []
+        self.pending_items = 0
+        self.pending_since = None
+        self.batches = []
+        self.outstanding = 0  # batches submitted but whose playlists aren't created
+        self.closing = False
+        # Updated from the pool, with self.condition held
+        self.results = {}
+        self.errors = []
+        self.counters = collections.Counter()
+
+        self.thread = threading.Thread(target=self._run)
+        self.thread.daemon = True
+        self.thread.start()
+
+    def submit(self, episode_name, tracks, playlist_description):
+        """Queues an episode; returns immediately."""
+        with self.condition:
+            self.pending.append((episode_name, list(tracks), playlist_description))
+            self.pending_items += len(tracks)
+            if self.pending_since is None:
+                self.pending_since = time.time()
+            self.condition.notify()
+
+    def close(self):
+        """Flushes queued episodes and waits for all playlists to be created."""
+        with self.condition:
+            self.closing = True
+            self.condition.notify()
+        self.thread.join()
+        self.pool.close()
+        self.pool.join()
+        for error in self.errors:
+            self.logger.error('Catalog stage error: %s', error)
+        self.logger.info('Catalog stage calls: %s', dict(self.counters))
+        return self.results
+
+    def _run(self):
+        """Scheduler: cuts batches and hands due ticket polls to the pool."""
+        with self.condition:
+            while True:
+                now = time.time()
+
+                if self.pending and (self.closing or self.pending_items >= self.batch_size
+                                     or now - self.pending_since >= self.batch_wait):
+                    batch = Batch(len(self.batches), self.pending)
+                    self.batches.append(batch)
+                    self.pending, self.pending_items, self.pending_since = [], 0, None
+                    self.outstanding += 1
+                    batch.polling = True
+                    self.pool.apply_async(self._update, (batch,))
+
+                timeout = None
+                if self.pending:
+                    timeout = max(self.pending_since + self.batch_wait - now, 0)
+                for batch in self.batches:
+                    if batch.polling or batch.next_poll is None:
+                        continue
+                    if batch.next_poll <= now:
+                        batch.polling = True
+                        self.pool.apply_async(self._poll, (batch,))
+                    else:
+                        wait = batch.next_poll - now
+                        timeout = wait if timeout is None else min(timeout, wait)
+
+                if self.closing and not self.pending and not self.outstanding:
+                    return
+                self.condition.wait(timeout)
+
+    def _schedule(self, batch, next_poll=None):
+        with self.condition:
+            batch.polling = False
+            batch.next_poll = next_poll
+            if next_poll is None:
+                self.outstanding -= 1
+            self.condition.notify()
+
+    def _count(self, call):
+        with self.condition:
+            self.counters[call] += 1
+
+    def _error(self, error):
+        with self.condition:
+            self.errors.append(error)
+
+    def _fail(self, batch, error):
+        self._error('batch %d: %s' % (batch.number, error))
+        self._schedule(batch)
+
+    def _update(self, batch):
+        items = []
+        for episode_name, tracks, description in batch.episodes:
+            for artist, album, title in tracks:
+                items.append({
+                    'action': 'update',
+                    'item': {
+                        'item_id': _item_id(episode_name, artist, title),
+                        'song_name': title,
+                        'artist_name': artist,
+                    }
+                })
+
+        try:
+            if not items:
+                self._create_playlists(batch, [])
+                return
+            catalog = self.catalog_factory(batch.catalog_name)
+            batch.ticket = catalog.update(items)
+            self._count('update')
+        except Exception as e:
+            self._fail(batch, e)
+            return
+
+        batch.submitted = time.time()
+        self.logger.info('Catalog %s: %d items from %d episodes, ticket %s',
+                         batch.catalog_name, len(items), len(batch.episodes), batch.ticket)
+        self._schedule(batch, time.time() + batch.interval)
+
+    def _read_items(self, catalog):
+        """Reads every item of ``catalog``, a page at a time."""
+        items = []
+        while True:
+            page = catalog.get_item_dicts(buckets=[config.ECHO_NEST_BUCKET, 'tracks'],
+                                          results=ITEM_PAGE_SIZE, start=len(items))
+            self._count('read')
+            items.extend(page)
+            total = getattr(page, 'total', None)
+            if not page or (total is not None and len(items) >= total) \
+                    or (total is None and len(page) < ITEM_PAGE_SIZE):
+                return items
+
+    def _poll(self, batch):
+        """Checks a ticket; backs off while it makes no progress.
+
+        Failed calls are retried with the same backoff; the batch only fails
+        after ``config.ECHO_NEST_RETRIES`` of them in a row."""
+        try:
+            catalog = self.catalog_factory(batch.catalog_name)
+            status = catalog.status(batch.ticket)
+            self._count('status')
+            items = None
+            if status['ticket_status'] == 'complete':
+                items = self._read_items(catalog)
+        except Exception as e:
+            batch.failures += 1
+            if batch.failures > config.ECHO_NEST_RETRIES:
+                self._fail(batch, e)
+                return
+            self.logger.warn('Catalog %s, ticket %s: %s (retry %d of %d)', batch.catalog_name,
+                             batch.ticket, e, batch.failures, config.ECHO_NEST_RETRIES)
+            batch.interval = min(batch.interval * 2, config.ECHO_NEST_SLEEP_MAX)
+            self._schedule(batch, time.time() + batch.interval * random.uniform(0.9, 1.1))
+            return
+        batch.failures = 0
+
+        ticket_status = status['ticket_status']
+        if ticket_status == 'complete':
+            self.logger.info('Catalog %s, ticket %s complete after %.1fs', batch.catalog_name,
+                             batch.ticket, time.time() - batch.submitted)
+            try:
+                self._create_playlists(batch, items)
+            except Exception as e:
+                self._fail(batch, e)
+            return
+        if ticket_status == 'error':
+            self._fail(batch, 'ticket %s failed: %s' % (batch.ticket, status))
+            return
+
+        percent_complete = status.get('percent_complete')
+        if percent_complete is not None and percent_complete != batch.percent_complete:
+            # Progressing: estimate the time left from the rate so far
+            elapsed = time.time() - batch.submitted
+            if percent_complete > 0:
+                remaining = elapsed * (100 - percent_complete) / percent_complete
+                batch.interval = min(max(remaining / 2, config.ECHO_NEST_SLEEP),
+                                     config.ECHO_NEST_SLEEP_MAX)
+            batch.percent_complete = percent_complete
+        else:
+            batch.interval = min(batch.interval * 2, config.ECHO_NEST_SLEEP_MAX)
+
+        self._schedule(batch, time.time() + batch.interval * random.uniform(0.9, 1.1))
+
+    def _create_playlists(self, batch, items):
+        found_rdio_tracks = collections.defaultdict(list)
+        for item in items:
+            if item.get('tracks'):
+                found_rdio_tracks[_item_episode(item)].append(
+                    item['tracks'][0]['foreign_id'].split(':')[2])
+
+        for episode_name, tracks, description in batch.episodes:
+            try:
+                result = self.create_playlist(
+                    episode_name, description, found_rdio_tracks[episode_name])
+                with self.condition:
+                    self.results[episode_name] = result
+                    self.counters['playlist'] += 1
+            except Exception as e:
+                self._error('%s: %s' % (episode_name, e))
+
+        self._schedule(batch)
+
+
+class MockCatalogService(object):
+    """In-memory stand-in for the Echo Nest catalog API.
+
+    Tickets complete ``latency`` seconds after the update, reporting linear
+    progress until then. Every song resolves to a made up Rdio track."""
+
+    def __init__(self, latency=3.0):
+        self.latency = latency
+        self.lock = threading.Lock()
+        self.catalogs = collections.defaultdict(list)
+        self.tickets = {}
+        self.calls = collections.Counter()
+
+    def catalog(self, name):
+        return MockCatalog(self, name)
+
+
+class MockCatalog(object):
+
+    def __init__(self, service, name):
+        self.service = service
+        self.name = name
+
+    def update(self, items):
+        with self.service.lock:
+            self.service.calls['update'] += 1
+            self.service.catalogs[self.name].extend(items)
+            ticket = 'ticket-%d' % len(self.service.tickets)
+            self.service.tickets[ticket] = time.time()
+        return ticket
+
+    def status(self, ticket):
+        with self.service.lock:
+            self.service.calls['status'] += 1
+            elapsed = time.time() - self.service.tickets[ticket]
+        if elapsed >= self.service.latency:
+            return {'ticket_status': 'complete', 'percent_complete': 100}
+        return {'ticket_status': 'pending',
+                'percent_complete': int(100 * elapsed / self.service.latency)}
+
+    def get_item_dicts(self, buckets=None, results=15, start=0):
+        """Pages like the real API: ``results`` items from ``start``, at most 100."""
+        with self.service.lock:
+            self.service.calls['read'] += 1
+            catalog = self.service.catalogs[self.name]
+            items = catalog[start:start + min(results, ITEM_PAGE_SIZE)]
+            total = len(catalog)
+        return MockResultList([{
+            'artist_name': item['item']['artist_name'],
+            'song_name': item['item']['song_name'],
+            'request': item['item'],
+            'tracks': [{'foreign_id': 'rdio-US:track:t%s' % item['item']['item_id'][-8:]}],
+        } for item in items], start, total)
+
+
+class MockResultList(list):
+    """Like pyechonest's ResultList, a page that knows the total item count."""
+
+    def __init__(self, items, start, total):
+        list.__init__(self, items)
+        self.start = start
+        self.total = total
+
+
+def main(argv):
+    """Pushes synthetic episodes through the stage against the mock services."""
+    num_episodes = int(argv[0]) if argv else 20
+    service = MockCatalogService()
+    created = []
+
+    def create_playlist(name, description, tracks):
+        created.append((time.time(), name, len(tracks)))
+        return {'status': 0, 'result': {'name': name}}
+
+    started = time.time()
+    stage = CatalogStage(catalog_factory=service.catalog, create_playlist=create_playlist)
+    for episode in range(num_episodes):
+        tracks = [('Artist %d' % i, 'Album %d' % i, 'Title %d-%d' % (episode, i))
+                  for i in range(12)]
+        stage.submit('episode-%03d' % episode, tracks, 'mock episode %d' % episode)
+        time.sleep(0.1)  # episodes trickle in from fingerprinting
+    stage.close()
+
+    print 'episodes', num_episodes
+    print 'playlists', len(created)
+    print 'playlist_tracks %d of %d' % (sum(n for (_, _, n) in created), num_episodes * 12)
+    print 'wall_seconds %.2f' % (time.time() - started)
+    print 'first_playlist_seconds %.2f' % (min(t for (t, _, _) in created) - started)
+    for call, count in sorted(service.calls.items()):
+        print 'calls_%s %d' % (call, count)
+    return 0
+
+
+if __name__ == '__main__':
+    logging.basicConfig(level=logging.INFO)
+    sys.exit(main(sys.argv[1:]))
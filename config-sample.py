@@ -21,16 +21,73 @@ SRC_MP3 = 'http://podcastdownload.npr.org/anon.npr-podcasts/podcast/510019/88710
 """Sample size in seconds to split the episode into"""
 WAVE_SAMPLE_SIZE = 10  # in seconds
 
+"""Seconds between the starts of consecutive samples; less than WAVE_SAMPLE_SIZE overlaps them"""
+WAVE_HOP_SIZE = 10  # in seconds
+
+"""Samples with a lower RMS level (16-bit) are not fingerprinted; 0 keeps them all"""
+WAVE_MIN_RMS = 0
+
+"""Seconds of a live stream in each query (live.py)"""
+LIVE_WINDOW = 8  # in seconds
+
+"""Seconds of a live stream between queries; a track is reported within LIVE_WINDOW + LIVE_CADENCE seconds plus the query time"""
+LIVE_CADENCE = 4  # in seconds
+
+"""Number of slices fingerprinted by one gnfingerprint run; it reads ahead of the queries"""
+FINGERPRINT_BATCH_SIZE = 50
+
+"""Identify slices in-process when the gnfingerprint Python extension is installed"""
+FINGERPRINT_IN_PROCESS = True
+
+"""Number of slices identified at once in-process"""
+FINGERPRINT_THREADS = 4
+
 """Only include a track if it is matched this many times in the episode"""
 FILTER_COUNT = 1
 
+"""Episodes longer than this many seconds are split into several shards"""
+SHARD_SECONDS = 600
+
+"""A shard lease not renewed for this many seconds can be reclaimed"""
+SHARD_LEASE_TIMEOUT = 120
+
+"""A shard that fails this many times is left for inspection (failures/ in the work directory)"""
+SHARD_MAX_ATTEMPTS = 3
+
 """Which catalog to map the identified tracks to"""
 ECHO_NEST_BUCKET = 'id:rdio-US'
 
 """Number of seconds to wait between checking a catalog ticket status"""
 ECHO_NEST_SLEEP = 1
 
+"""Tickets that make no progress are polled less often, up to this many seconds apart"""
+ECHO_NEST_SLEEP_MAX = 10
+
+"""Episodes are merged into one catalog update once this many items are queued..."""
+ECHO_NEST_BATCH_SIZE = 500
+
+"""...or the oldest queued episode has waited this many seconds"""
+ECHO_NEST_BATCH_WAIT = 5
+
+"""Number of concurrent Echo Nest and Rdio calls"""
+ECHO_NEST_WORKERS = 4
+
+"""Failed ticket polls in a row that are retried before the batch's episodes are given up"""
+ECHO_NEST_RETRIES = 3
+
 """Passed to requests.Response.iter_content()"""
-DOWNLOAD_CHUNK_SIZE = 1024
+DOWNLOAD_CHUNK_SIZE = 64 * 1024
+
+"""Episodes are downloaded in ranges of this many bytes..."""
+DOWNLOAD_RANGE_SIZE = 4 * 1024 * 1024
+
+"""...over this many concurrent connections"""
+DOWNLOAD_CONNECTIONS = 4
+
+"""Number of times a failed range is retried before giving up"""
+DOWNLOAD_RETRIES = 3
+
+"""Episodes are downloaded under this directory, in one directory per URL that is kept until the episode is processed, so an interrupted run resumes its download; None uses the system temp directory"""
+DOWNLOAD_DIR = None
 
 RDIO_API_URL = 'https://www.rdio.com/api/1/'
@@ -0,0 +1,222 @@
+"""Parallel, resumable episode downloads.
+
+The file is split into ranges of ``config.DOWNLOAD_RANGE_SIZE`` bytes which
+``config.DOWNLOAD_CONNECTIONS`` threads fetch concurrently into a preallocated
+file. Finished ranges are recorded in a checkpoint next to the file, so an
+interrupted download only fetches the missing ranges when run again, and a
+dropped connection only retries its own range. Servers that don't support
+ranges are downloaded as a single stream.
+
+Bytes are handed to an optional ``consumer`` in order as soon as they are
+contiguous, so decoding can start before the download finishes.
+"""
+import hashlib
+import json
+import logging
+import os
+import os.path
+import threading
+
+import requests
+
+import config
+
+
+class RangedDownload(object):
+
+    def __init__(self, src_url, dst_path, connections=None, range_size=None):
+        self.src_url = src_url
+        self.dst_path = dst_path
+        self.checkpoint_path = '%s.ranges' % dst_path
+        self.connections = connections or config.DOWNLOAD_CONNECTIONS
+        self.range_size = range_size or config.DOWNLOAD_RANGE_SIZE
+        self.logger = logging.getLogger('downloader')
+
+        self.condition = threading.Condition()
+        self.done = set()
+        self.next_range = 0
+        self.error = None
+
+    def _probe(self):
+        """Returns (length, validator) if the server supports ranges, else None."""
+        try:
+            r = requests.head(self.src_url, allow_redirects=True)
+            r.raise_for_status()
+        except requests.exceptions.RequestException as e:
+            self.logger.info('HEAD %s failed (%s), probing with a range request', self.src_url, e)
+            return self._probe_range()
+        length = r.headers.get('content-length')
+        if r.headers.get('accept-ranges', '').lower() != 'bytes' or not length:
+            # Plenty of servers honour ranges without advertising them
+            return self._probe_range()
+        self.src_url = r.url  # don't follow the redirect again for every range
+        return int(length), r.headers.get('etag') or r.headers.get('last-modified')
+
+    def _probe_range(self):
+        """Like ``_probe`` for servers that reject HEAD or don't advertise ranges:
+        asks for the first byte and reads the length from Content-Range."""
+        try:
+            r = requests.get(self.src_url, stream=True, headers={'Range': 'bytes=0-0'})
+        except requests.exceptions.RequestException:
+            return None
+        try:
+            content_range = r.headers.get('content-range', '')
+            if r.status_code != 206 or not content_range.startswith('bytes 0-0/'):
+                return None
+            length = content_range.split('/', 1)[1]
+            if not length.isdigit():
+                return None
+            self.src_url = r.url
+            return int(length), r.headers.get('etag') or r.headers.get('last-modified')
+        finally:
+            r.close()
+
+    def _load_checkpoint(self, length, validator):
+        """Returns the ranges already on disk for this exact remote file."""
+        if validator is None:
+            # Without an ETag or Last-Modified a changed file of the same length
+            # would resume into a mix of old and new bytes
+            return set()
+        try:
+            with open(self.checkpoint_path) as fp:
+                checkpoint = json.load(fp)
+        except (IOError, ValueError):
+            return set()
+        if (checkpoint.get('length') != length or checkpoint.get('validator') != validator
+                or checkpoint.get('range_size') != self.range_size
+                or not os.path.exists(self.dst_path)):
+            return set()
+        return set(checkpoint['done'])
+
+    def _save_checkpoint(self, length, validator):
+        """Called with ``self.condition`` held."""
+        if validator is None:
+            return
+        tmp_path = '%s.tmp' % self.checkpoint_path
+        with open(tmp_path, 'w') as fp:
+            json.dump({'length': length, 'validator': validator,
+                       'range_size': self.range_size, 'done': sorted(self.done)}, fp)
+        os.rename(tmp_path, self.checkpoint_path)
+
+    def _fetch_range(self, index, length):
+        start = index * self.range_size
+        end = min(start + self.range_size, length) - 1
+
+        r = requests.get(self.src_url, stream=True,
+                         headers={'Range': 'bytes=%d-%d' % (start, end)})
+        try:
+            r.raise_for_status()
+            if r.status_code != 206:
+                raise IOError('Server ignored range request for bytes %d-%d' % (start, end))
+
+            written = 0
+            with open(self.dst_path, 'r+b') as fp:
+                fp.seek(start)
+                for chunk in r.iter_content(config.DOWNLOAD_CHUNK_SIZE):
+                    fp.write(chunk)
+                    written += len(chunk)
+        finally:
+            r.close()
+        if written != end - start + 1:
+            raise IOError('Range %d-%d ended after %d bytes' % (start, end, written))
+
+    def _worker(self, num_ranges, length, validator):
+        while True:
+            with self.condition:
+                while self.next_range < num_ranges and self.next_range in self.done:
+                    self.next_range += 1
+                if self.next_range >= num_ranges or self.error is not None:
+                    return
+                index = self.next_range
+                self.next_range += 1
+
+            try:
+                for attempt in range(config.DOWNLOAD_RETRIES + 1):
+                    try:
+                        self._fetch_range(index, length)
+                        break
+                    except (IOError, requests.exceptions.RequestException) as e:
+                        self.logger.warn('Range %d of %s failed (attempt %d): %s', index,
+                                         self.src_url, attempt + 1, e)
+                        last_error = e
+                else:
+                    raise last_error
+
+                with self.condition:
+                    self.done.add(index)
+                    self._save_checkpoint(length, validator)
+                    self.condition.notify_all()
+            except Exception as e:
+                # Anything that stops this worker fails the download, or the
+                # consumer would wait for the range forever
+                if not isinstance(e, (IOError, requests.exceptions.RequestException)):
+                    self.logger.exception('Range %d of %s failed', index, self.src_url)
+                with self.condition:
+                    if self.error is None:
+                        self.error = e
+                    self.condition.notify_all()
+                return
+
+    def _run_ranged(self, length, validator, consumer):
+        num_ranges = (length + self.range_size - 1) // self.range_size
+        self.done = self._load_checkpoint(length, validator)
+        if validator is None:
+            self.logger.info('%s has no ETag or Last-Modified, it will not resume', self.src_url)
+        if self.done:
+            self.logger.info('Resuming %s: %d of %d ranges already downloaded',
+                             self.dst_path, len(self.done), num_ranges)
+        else:
+            with open(self.dst_path, 'wb') as fp:
+                fp.truncate(length)
+
+        threads = [threading.Thread(target=self._worker, args=(num_ranges, length, validator))
+                   for _ in range(min(self.connections, num_ranges))]
+        for thread in threads:
+            thread.daemon = True
+            thread.start()
+
+        # Release ranges to the consumer in order as they become contiguous. Unbuffered,
+        # so read-ahead can't serve bytes from before another thread wrote them.
+        with open(self.dst_path, 'rb', 0) as fp:
+            for index in range(num_ranges):
+                with self.condition:
+                    while index not in self.done and self.error is None:
+                        self.condition.wait(1)
+                    if self.error is not None:
+                        raise self.error
+                if consumer is not None:
+                    fp.seek(index * self.range_size)
+                    consumer(fp.read(self.range_size))
+
+        for thread in threads:
+            thread.join()
+        # Empty files and files without a validator never write a checkpoint
+        if os.path.exists(self.checkpoint_path):
+            os.unlink(self.checkpoint_path)
+
+    def _run_single(self, consumer):
+        r = requests.get(self.src_url, stream=True)
+        r.raise_for_status()
+        with open(self.dst_path, 'wb') as fp:
+            for chunk in r.iter_content(config.DOWNLOAD_CHUNK_SIZE):
+                fp.write(chunk)
+                if consumer is not None:
+                    consumer(chunk)
+
+    def run(self, consumer=None):
+        """Downloads the file; returns its path."""
+        probe = self._probe()
+        if probe is None:
+            self.logger.info('No range support, streaming %s', self.src_url)
+            self._run_single(consumer)
+        else:
+            length, validator = probe
+            self.logger.info('Downloading %s (%d bytes) over %d connections', self.src_url,
+                             length, self.connections)
+            self._run_ranged(length, validator, consumer)
+        return self.dst_path
+
+
+def episode_path(src_url, dst_dir):
+    """The download path of ``src_url``; stable so that downloads can resume."""
+    return os.path.join(dst_dir, 'episode-%s.mp3' % hashlib.sha1(src_url).hexdigest()[:12])
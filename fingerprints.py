@@ -0,0 +1,125 @@
+"""Offline fingerprint export and deferred, batched lookup.
+
+Generating fingerprints only needs CPU and looking them up only needs the
+network, so the two can run on different machines and at different times:
+
+    python fingerprints.py export episodes.gnfp episode.wav http://example.com/episode.mp3
+    python fingerprints.py lookup episodes.gnfp [more.gnfp ...]
+
+``export`` fingerprints every window of each episode with ``gnfingerprint
+--export`` and appends the fingerprints to a records file, tagged with the
+episode and the window's offset. Windows follow ``config.WAVE_SAMPLE_SIZE``,
+``config.WAVE_HOP_SIZE`` and ``config.WAVE_MIN_RMS`` like ``split_wave_file``,
+but no slice files are written. Any number of exports may append to one file.
+
+``lookup`` identifies the windows of records files with ``gnfingerprint
+--lookup``, which looks them up in large batches over a few threads that each
+reuse one query handle, and prints the tracks of each episode.
+"""
+import argparse
+import collections
+import logging
+import os
+import os.path
+import shutil
+import subprocess
+import sys
+import tempfile
+
+import config
+import podmapper
+
+
+def _gnfingerprint(options, paths):
+    return ['gnfingerprint'] + options + [
+        config.GRACENOTE_CLIENT_ID,
+        config.GRACENOTE_CLIENT_TAG,
+        config.GRACENOTE_LICENCE_PATH,
+    ] + list(paths)
+
+
+def export(records_path, episodes, window=None, hop=None, min_rms=None):
+    """Appends the fingerprints of every window of ``episodes`` (WAV paths or
+    MP3 URLs) to ``records_path``. Episodes are tagged with their file name."""
+
+    logger = logging.getLogger('fingerprint-exporter')
+
+    if window is None:
+        window = config.WAVE_SAMPLE_SIZE
+    if hop is None:
+        hop = config.WAVE_HOP_SIZE
+    if min_rms is None:
+        min_rms = config.WAVE_MIN_RMS
+    options = ['--export', records_path, '--window', str(window), '--hop', str(hop),
+               '--min-rms', str(min_rms)]
+
+    for episode in episodes:
+        if episode.startswith('http://') or episode.startswith('https://'):
+            tmp_dir = tempfile.mkdtemp(prefix='podmapper-export-')
+            try:
+                downloaded_path, wave_path = podmapper.download_and_convert(episode, tmp_dir)
+                logger.info('Exporting %s to %s', episode, records_path)
+                subprocess.check_call(_gnfingerprint(options, [wave_path]))
+            finally:
+                shutil.rmtree(tmp_dir)
+        else:
+            logger.info('Exporting %s to %s', episode, records_path)
+            subprocess.check_call(_gnfingerprint(options, [episode]))
+
+
+def lookup(records_paths):
+    """Identifies every window stored in ``records_paths``.
+
+    Returns {episode: [(offset, matched track or None)]} ordered by offset."""
+
+    output = subprocess.check_output(_gnfingerprint(['--lookup'], records_paths))
+
+    # Each window's output follows a "Window: <offset> <episode>" line
+    sections = []
+    for line in output.split('\n'):
+        if line.strip().startswith('Window:'):
+            offset, episode = line.strip()[len('Window:'):].strip().split(' ', 1)
+            sections.append((episode, float(offset), []))
+        elif sections:
+            sections[-1][2].append(line)
+
+    windows = collections.defaultdict(list)
+    for episode, offset, lines in sections:
+        matched_track = podmapper.parse_fingerprint_output(
+            '%s at %.3fs' % (episode, offset), '\n'.join(lines))
+        windows[episode].append((offset, matched_track))
+    for episode_windows in windows.values():
+        episode_windows.sort()
+    return windows
+
+
+def main(argv):
+    parser = argparse.ArgumentParser(description=__doc__.split('\n')[0])
+    subparsers = parser.add_subparsers(dest='command')
+
+    export_parser = subparsers.add_parser('export', help='fingerprint episodes without lookups')
+    export_parser.add_argument('records')
+    export_parser.add_argument('episodes', nargs='+', help='WAV paths or MP3 URLs')
+
+    lookup_parser = subparsers.add_parser('lookup', help='identify exported fingerprints')
+    lookup_parser.add_argument('records', nargs='+')
+
+    args = parser.parse_args(argv)
+
+    if args.command == 'export':
+        export(args.records, args.episodes)
+    elif args.command == 'lookup':
+        windows = lookup(args.records)
+        for episode in sorted(windows):
+            print episode
+            found_tracks = [track for (offset, track) in windows[episode] if track is not None]
+            podmapper.print_tracks(podmapper.trim_tracks(found_tracks))
+            print
+
+    return 0
+
+
+if __name__ == '__main__':
+    logging.basicConfig(level=logging.INFO)
+    logging.getLogger('fingerprint').setLevel(logging.WARN)
+    sys.exit(main(sys.argv[1:]))
@@ -0,0 +1,1963 @@
+/*
+ * Copyright (c) 2000-2012 Gracenote.
+ *
+ * This software may not be used in any way or distributed without
+ * permission. All rights reserved.
+ *
+ * Some code herein may be covered by US and international patents.
+*/
+
+/*
+ *  Name: gnfingerprint
+ *  Description:
+ *  Library that uses MusicID-Stream to fingerprint and identify music in PCM
+ *  buffers, based on the musicid_stream sample. See gnfingerprint.h for the API.
+*/
+
+/* GNSDK headers
+ *
+ * Define the modules your application needs.
+ * These constants enable inclusion of headers and symbols in gnsdk.h.
+ */
+#define GNSDK_MUSICID               1
+#define GNSDK_STORAGE_SQLITE		1
+#define GNSDK_DSP					1
+#include "gnsdk.h"
+
+#include "gnfingerprint.h"
+
+/* Standard C headers - used by the sample app, but not required for GNSDK */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+/* POSIX headers - used by the logging subsystem and the user registration cache */
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ * Logging
+ *
+ * Events are appended to a lock-free ring buffer and written out by a
+ * background flusher thread, so logging never blocks on file I/O. When an
+ * event's level is disabled, GNFP_LOG() costs one load and one compare.
+ *
+ * Configured through the environment:
+ *   GNFP_LOG_LEVEL		none, error, warning, info or debug (default: warning)
+ *   GNFP_LOG_PATH		log file, "%p" is replaced by the process ID (default: gnfingerprint-%p.log)
+ *   GNFP_LOG_MAX_SIZE	rotate the log after this many bytes (default: 10485760)
+ *   GNFP_LOG_KEEP		number of rotated logs to keep (default: 3)
+ *
+ * SIGUSR1 raises and SIGUSR2 lowers the level of a running process, unless
+ * the application already handles those signals.
+ * The log runs while a session is open; the file is only created once the
+ * first event is flushed. Levels are defined in gnfingerprint.h.
+ */
+#define GNFP_LOG_RING_SIZE		1024	/* Must be a power of two */
+#define GNFP_LOG_TEXT_SIZE		112
+
+typedef enum
+{
+	GNFP_EVENT_MESSAGE = 0,
+	GNFP_EVENT_WINDOW_BEGIN,			/* a: window index */
+	GNFP_EVENT_WINDOW_END,				/* a: window index, b: PCM bytes fingerprinted */
+	GNFP_EVENT_QUERY_BEGIN,				/* a: window index */
+	GNFP_EVENT_QUERY_END,				/* a: window index, b: matched track count */
+	GNFP_EVENT_SDK_ERROR,				/* a: GNSDK error code, b: source line */
+	GNFP_EVENT_COUNT
+} _log_event_t;
+
+typedef struct
+{
+	unsigned long			sequence;
+	struct timespec			timestamp;
+	int						level;
+	int						event;
+	long long				a;
+	long long				b;
+	char					text[GNFP_LOG_TEXT_SIZE];
+} _log_record_t;
+
+static volatile sig_atomic_t	s_log_level	= GNFP_LOG_WARNING;
+
+/* Index of the next window to fingerprint, for correlating events */
+static long long				s_window_index	= 0;
+
+/* An open session: the GNSDK user all queries are made for */
+struct gnfp_session_s
+{
+	gnsdk_user_handle_t		user_handle;
+	char*					client_id;
+};
+
+/* A query handle reused for deferred lookups, and a buffer to NUL-terminate their input */
+struct gnfp_lookup_s
+{
+	gnsdk_musicid_query_handle_t	query_handle;
+	char*							fp_data;
+	size_t							fp_capacity;
+};
+
+/* Set while a session is open, GNSDK can only be initialized once per process */
+static int						s_session_open	= 0;
+
+#define GNFP_LOG(level, event, a, b, text) \
+	do { if ((level) <= s_log_level) _log_event((level), (event), (a), (b), (text)); } while (0)
+
+/*
+ * Local function declarations
+ */
+static void
+_display_error(
+	int						line_num,
+	const char*				info,
+	gnsdk_error_t			error_code
+	);
+
+static void
+_log_init(void);
+
+static void
+_log_shutdown(void);
+
+static void
+_log_event(
+	int						level,
+	int						event,
+	long long				a,
+	long long				b,
+	const char*				text
+	);
+
+static int
+_init_gnsdk(
+	const char*				client_id,
+	const char*				client_id_tag,
+	const char*				client_app_version,
+	const char*				license_path,
+	gnsdk_user_handle_t*	p_user_handle
+	);
+
+static void
+_shutdown_gnsdk(
+	gnsdk_user_handle_t		user_handle,
+	const char*				client_id
+	);
+
+static int
+_do_sample_musicid_stream(
+	gnsdk_user_handle_t		user_handle,
+	const char*				pcm_audio,
+	size_t					pcm_length,
+	unsigned int			sample_rate,
+	unsigned int			sample_bits,
+	unsigned int			channels,
+	gnfp_result_t*			result
+	);
+
+static int
+_set_query_fingerprint(
+	gnsdk_musicid_query_handle_t	query_handle,
+	long long						window_index,
+	const char*						pcm_audio,
+	size_t							pcm_length,
+	unsigned int					sample_rate,
+	unsigned int					sample_bits,
+	unsigned int					channels
+	);
+
+static int
+_find_track(
+	gnsdk_musicid_query_handle_t	query_handle,
+	long long						window_index,
+	gnfp_result_t*					result
+	);
+
+/*
+*  Public API, see gnfingerprint.h.
+*/
+int
+gnfp_session_open(
+	const char*				client_id,
+	const char*				client_id_tag,
+	const char*				client_app_version,
+	const char*				license_path,
+	gnfp_session_t**		p_session
+	)
+{
+	gnfp_session_t*		session		= NULL;
+	int					expected	= 0;
+
+	if (!__atomic_compare_exchange_n(&s_session_open, &expected, 1, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+	{
+		return GNFP_BUSY;
+	}
+
+	session = calloc(1, sizeof(gnfp_session_t));
+	if (NULL != session)
+	{
+		session->client_id = strdup(client_id);
+	}
+	if (NULL == session || NULL == session->client_id)
+	{
+		fprintf(stderr, "Error allocating memory.\n");
+		free(session);
+		__atomic_store_n(&s_session_open, 0, __ATOMIC_RELEASE);
+		return GNFP_ERROR;
+	}
+
+	_log_init();
+
+	if (0 != _init_gnsdk(client_id, client_id_tag, client_app_version, license_path, &session->user_handle))
+	{
+		_log_shutdown();
+		free(session->client_id);
+		free(session);
+		__atomic_store_n(&s_session_open, 0, __ATOMIC_RELEASE);
+		return GNFP_ERROR;
+	}
+
+	*p_session = session;
+	return GNFP_SUCCESS;
+}
+
+void
+gnfp_session_close(
+	gnfp_session_t*			session
+	)
+{
+	if (NULL == session)
+	{
+		return;
+	}
+
+	/* Shut down while the log is still running, user cache counters are logged */
+	_shutdown_gnsdk(session->user_handle, session->client_id);
+	_log_shutdown();
+
+	free(session->client_id);
+	free(session);
+	__atomic_store_n(&s_session_open, 0, __ATOMIC_RELEASE);
+}
+
+int
+gnfp_identify(
+	gnfp_session_t*			session,
+	const void*				pcm,
+	size_t					pcm_length,
+	unsigned int			sample_rate,
+	unsigned int			sample_bits,
+	unsigned int			channels,
+	gnfp_result_t*			result
+	)
+{
+	memset(result, 0, sizeof(gnfp_result_t));
+
+	if (0 != _do_sample_musicid_stream(
+				session->user_handle,
+				pcm,
+				pcm_length,
+				sample_rate,
+				sample_bits,
+				channels,
+				result
+				))
+	{
+		return GNFP_ERROR;
+	}
+
+	return GNFP_SUCCESS;
+}
+
+int
+gnfp_fingerprint(
+	gnfp_session_t*			session,
+	const void*				pcm,
+	size_t					pcm_length,
+	unsigned int			sample_rate,
+	unsigned int			sample_bits,
+	unsigned int			channels,
+	char**					p_fp_data,
+	size_t*					p_fp_length
+	)
+{
+	gnsdk_error_t					error			= GNSDK_SUCCESS;
+	gnsdk_musicid_query_handle_t	query_handle	= GNSDK_NULL;
+	gnsdk_cstr_t					fp_data			= GNSDK_NULL;
+	long long						window_index	= 0;
+	int								rc				= GNFP_SUCCESS;
+
+	window_index = __atomic_fetch_add(&s_window_index, 1, __ATOMIC_RELAXED);
+
+	error = gnsdk_musicid_query_create(session->user_handle, GNSDK_NULL, GNSDK_NULL, &query_handle);
+	if (GNSDK_SUCCESS != error)
+	{
+		_display_error(__LINE__, "gnsdk_musicid_query_create()", error);
+		return GNFP_ERROR;
+	}
+
+	if (0 != _set_query_fingerprint(query_handle, window_index, pcm, pcm_length, sample_rate, sample_bits, channels))
+	{
+		rc = GNFP_ERROR;
+	}
+
+	if (GNFP_SUCCESS == rc)
+	{
+		/* The data is owned by the query handle, copy it out before releasing it */
+		error = gnsdk_musicid_query_get_fp_data(query_handle, &fp_data);
+		if (GNSDK_SUCCESS != error)
+		{
+			_display_error(__LINE__, "gnsdk_musicid_query_get_fp_data()", error);
+			rc = GNFP_ERROR;
+		}
+		else
+		{
+			*p_fp_data = strdup(fp_data);
+			if (NULL == *p_fp_data)
+			{
+				fprintf(stderr, "Error allocating memory.\n");
+				rc = GNFP_ERROR;
+			}
+			else
+			{
+				*p_fp_length = strlen(fp_data);
+			}
+		}
+	}
+
+	gnsdk_musicid_query_release(query_handle);
+
+	return rc;
+}
+
+int
+gnfp_lookup_open(
+	gnfp_session_t*			session,
+	gnfp_lookup_t**			p_lookup
+	)
+{
+	gnfp_lookup_t*	lookup	= NULL;
+	gnsdk_error_t	error	= GNSDK_SUCCESS;
+
+	lookup = calloc(1, sizeof(gnfp_lookup_t));
+	if (NULL == lookup)
+	{
+		fprintf(stderr, "Error allocating memory.\n");
+		return GNFP_ERROR;
+	}
+
+	error = gnsdk_musicid_query_create(session->user_handle, GNSDK_NULL, GNSDK_NULL, &lookup->query_handle);
+	if (GNSDK_SUCCESS != error)
+	{
+		_display_error(__LINE__, "gnsdk_musicid_query_create()", error);
+		free(lookup);
+		return GNFP_ERROR;
+	}
+
+	*p_lookup = lookup;
+	return GNFP_SUCCESS;
+}
+
+int
+gnfp_lookup(
+	gnfp_lookup_t*			lookup,
+	const char*				fp_data,
+	size_t					fp_length,
+	gnfp_result_t*			result
+	)
+{
+	gnsdk_error_t	error			= GNSDK_SUCCESS;
+	char*			buffer			= NULL;
+	long long		window_index	= 0;
+
+	memset(result, 0, sizeof(gnfp_result_t));
+	window_index = __atomic_fetch_add(&s_window_index, 1, __ATOMIC_RELAXED);
+
+	if (fp_length + 1 > lookup->fp_capacity)
+	{
+		buffer = realloc(lookup->fp_data, fp_length + 1);
+		if (NULL == buffer)
+		{
+			fprintf(stderr, "Error allocating memory.\n");
+			return GNFP_ERROR;
+		}
+		lookup->fp_data = buffer;
+		lookup->fp_capacity = fp_length + 1;
+	}
+	memcpy(lookup->fp_data, fp_data, fp_length);
+	lookup->fp_data[fp_length] = '\0';
+
+	/* Replaces the input of the previous lookup, including a follow-up query's track */
+	error = gnsdk_musicid_query_set_fp_data(lookup->query_handle, lookup->fp_data, GNSDK_MUSICID_FP_DATA_TYPE_GNFPX);
+	if (GNSDK_SUCCESS != error)
+	{
+		_display_error(__LINE__, "gnsdk_musicid_query_set_fp_data()", error);
+		return GNFP_ERROR;
+	}
+
+	if (0 != _find_track(lookup->query_handle, window_index, result))
+	{
+		return GNFP_ERROR;
+	}
+
+	return GNFP_SUCCESS;
+}
+
+void
+gnfp_lookup_close(
+	gnfp_lookup_t*			lookup
+	)
+{
+	if (NULL == lookup)
+	{
+		return;
+	}
+
+	gnsdk_musicid_query_release(lookup->query_handle);
+	free(lookup->fp_data);
+	free(lookup);
+}
+
+void
+gnfp_log(
+	int						level,
+	long long				a,
+	long long				b,
+	const char*				text
+	)
+{
+	if (level < GNFP_LOG_ERROR || level > GNFP_LOG_DEBUG)
+	{
+		return;
+	}
+
+	GNFP_LOG(level, GNFP_EVENT_MESSAGE, a, b, text);
+}
+
+/*
+* Echo the error and information.
+*/
+static void
+_display_error(
+	int				line_num,
+	const char*		info,
+	gnsdk_error_t	error_code
+	)
+{
+	const	gnsdk_error_info_t*	error_info = gnsdk_manager_error_info();
+
+	/* Error_info will never be GNSDK_NULL.
+	 * The SDK will always return a pointer to a populated error info structure.
+	 */
+	fprintf(stderr,
+		"\nerror 0x%08x - %s\n\tline %d, info %s\n",
+		error_code,
+		error_info->error_description,
+		line_num,
+		info
+		);
+
+	GNFP_LOG(GNFP_LOG_ERROR, GNFP_EVENT_SDK_ERROR, error_code, line_num, info);
+}
+
+/*
+*  Logging subsystem, see the description at the top of the file.
+*/
+static const char* s_log_level_names[] = { "none", "error", "warning", "info", "debug" };
+
+static const char* s_log_event_names[GNFP_EVENT_COUNT] =
+{
+	"message",
+	"window_begin",
+	"window_end",
+	"query_begin",
+	"query_end",
+	"sdk_error"
+};
+
+static struct
+{
+	_log_record_t			ring[GNFP_LOG_RING_SIZE];
+	unsigned long			enqueue_pos;		/* Shared by producers, updated with CAS */
+	unsigned long			dequeue_pos;		/* Owned by the flusher */
+	unsigned long			dropped;			/* Events lost because the ring was full */
+
+	char					path[1024];
+	FILE*					file;
+	long					written;
+	long					max_size;
+	int						keep;
+
+	pthread_t				flusher;
+	int						flusher_running;
+	pthread_mutex_t			stop_mutex;
+	pthread_cond_t			stop_cond;			/* Wakes the flusher early to stop */
+	int						stop;				/* Guarded by stop_mutex */
+} s_log;
+
+static void
+_log_signal_handler(int signum)
+{
+	if (SIGUSR1 == signum && s_log_level < GNFP_LOG_DEBUG)
+	{
+		s_log_level++;
+	}
+	else if (SIGUSR2 == signum && s_log_level > GNFP_LOG_NONE)
+	{
+		s_log_level--;
+	}
+}
+
+/*
+*  Appends an event to the ring buffer (a bounded MPMC queue as described by
+*  Dmitry Vyukov: each slot's sequence number says whether it is free for the
+*  producer at that position or holds an event for the consumer). Never blocks;
+*  if the flusher has fallen behind the event is counted as dropped.
+*/
+static void
+_log_event(
+	int						level,
+	int						event,
+	long long				a,
+	long long				b,
+	const char*				text
+	)
+{
+	_log_record_t*	record	= NULL;
+	unsigned long	pos		= 0;
+	unsigned long	seq		= 0;
+	long			diff	= 0;
+
+	pos = __atomic_load_n(&s_log.enqueue_pos, __ATOMIC_RELAXED);
+	for (;;)
+	{
+		record = &s_log.ring[pos & (GNFP_LOG_RING_SIZE - 1)];
+		seq = __atomic_load_n(&record->sequence, __ATOMIC_ACQUIRE);
+		diff = (long)seq - (long)pos;
+		if (0 == diff)
+		{
+			if (__atomic_compare_exchange_n(&s_log.enqueue_pos, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+			{
+				break;
+			}
+		}
+		else if (diff < 0)
+		{
+			__atomic_fetch_add(&s_log.dropped, 1, __ATOMIC_RELAXED);
+			return;
+		}
+		else
+		{
+			pos = __atomic_load_n(&s_log.enqueue_pos, __ATOMIC_RELAXED);
+		}
+	}
+
+	clock_gettime(CLOCK_REALTIME, &record->timestamp);
+	record->level = level;
+	record->event = event;
+	record->a = a;
+	record->b = b;
+	if (NULL != text)
+	{
+		strncpy(record->text, text, GNFP_LOG_TEXT_SIZE - 1);
+		record->text[GNFP_LOG_TEXT_SIZE - 1] = '\0';
+	}
+	else
+	{
+		record->text[0] = '\0';
+	}
+
+	__atomic_store_n(&record->sequence, pos + 1, __ATOMIC_RELEASE);
+}
+
+/* Renames path.N-1 to path.N, ..., path to path.1 and reopens path */
+static void
+_log_rotate(void)
+{
+	char	from[1040];
+	char	to[1040];
+	int		i			= 0;
+
+	fclose(s_log.file);
+	s_log.file = NULL;
+	s_log.written = 0;
+
+	for (i = s_log.keep; i > 0; i--)
+	{
+		if (i > 1)
+		{
+			snprintf(from, sizeof(from), "%s.%d", s_log.path, i - 1);
+		}
+		else
+		{
+			snprintf(from, sizeof(from), "%s", s_log.path);
+		}
+		snprintf(to, sizeof(to), "%s.%d", s_log.path, i);
+		rename(from, to);
+	}
+	if (0 == s_log.keep)
+	{
+		remove(s_log.path);
+	}
+}
+
+static void
+_log_write_record(
+	const _log_record_t*	record
+	)
+{
+	struct tm	tm;
+	char		when[32];
+	int			len			= 0;
+
+	if (NULL == s_log.file)
+	{
+		s_log.file = fopen(s_log.path, "a");
+		if (NULL == s_log.file)
+		{
+			return;
+		}
+		s_log.written = ftell(s_log.file);
+	}
+
+	gmtime_r(&record->timestamp.tv_sec, &tm);
+	strftime(when, sizeof(when), "%Y-%m-%dT%H:%M:%S", &tm);
+
+	len = fprintf(s_log.file,
+		"%s.%06ldZ pid=%d level=%s event=%s a=%lld b=%lld%s%s\n",
+		when,
+		record->timestamp.tv_nsec / 1000,
+		(int)getpid(),
+		s_log_level_names[record->level],
+		s_log_event_names[record->event],
+		record->a,
+		record->b,
+		record->text[0] ? " msg=" : "",
+		record->text
+		);
+	if (len > 0)
+	{
+		s_log.written += len;
+	}
+
+	if (s_log.max_size > 0 && s_log.written >= s_log.max_size)
+	{
+		_log_rotate();
+	}
+}
+
+/* Writes out all complete events; only ever called from one thread at a time */
+static int
+_log_drain(void)
+{
+	_log_record_t*	record	= NULL;
+	int				count	= 0;
+
+	for (;;)
+	{
+		record = &s_log.ring[s_log.dequeue_pos & (GNFP_LOG_RING_SIZE - 1)];
+		if (__atomic_load_n(&record->sequence, __ATOMIC_ACQUIRE) != s_log.dequeue_pos + 1)
+		{
+			break;
+		}
+
+		_log_write_record(record);
+
+		__atomic_store_n(&record->sequence, s_log.dequeue_pos + GNFP_LOG_RING_SIZE, __ATOMIC_RELEASE);
+		s_log.dequeue_pos++;
+		count++;
+	}
+
+	if (count > 0 && NULL != s_log.file)
+	{
+		fflush(s_log.file);
+	}
+
+	return count;
+}
+
+static void*
+_log_flusher(void* arg)
+{
+	struct timespec	deadline;
+	int				stop		= 0;
+
+	(void)arg;
+	while (!stop)
+	{
+		if (0 == _log_drain())
+		{
+			/* Poll every 50ms; _log_shutdown() signals so exit doesn't wait for it */
+			clock_gettime(CLOCK_REALTIME, &deadline);
+			deadline.tv_nsec += 50 * 1000 * 1000;
+			if (deadline.tv_nsec >= 1000 * 1000 * 1000)
+			{
+				deadline.tv_sec++;
+				deadline.tv_nsec -= 1000 * 1000 * 1000;
+			}
+
+			pthread_mutex_lock(&s_log.stop_mutex);
+			if (!s_log.stop)
+			{
+				pthread_cond_timedwait(&s_log.stop_cond, &s_log.stop_mutex, &deadline);
+			}
+			pthread_mutex_unlock(&s_log.stop_mutex);
+		}
+
+		pthread_mutex_lock(&s_log.stop_mutex);
+		stop = s_log.stop;
+		pthread_mutex_unlock(&s_log.stop_mutex);
+	}
+
+	return NULL;
+}
+
+static void
+_log_init(void)
+{
+	const char*			value	= NULL;
+	char*				out		= s_log.path;
+	char*				end		= s_log.path + sizeof(s_log.path) - 1;
+	int					i		= 0;
+	struct sigaction	action;
+
+	/* A session may be opened again after an earlier one was closed */
+	for (i = 0; i < GNFP_LOG_RING_SIZE; i++)
+	{
+		s_log.ring[i].sequence = i;
+	}
+	s_log.enqueue_pos = 0;
+	s_log.dequeue_pos = 0;
+	s_log.dropped = 0;
+	s_log.stop = 0;
+	s_log.max_size = 10 * 1024 * 1024;
+	s_log.keep = 3;
+
+	value = getenv("GNFP_LOG_LEVEL");
+	if (NULL != value)
+	{
+		for (i = GNFP_LOG_NONE; i <= GNFP_LOG_DEBUG; i++)
+		{
+			if (0 == strcmp(value, s_log_level_names[i]))
+			{
+				s_log_level = i;
+			}
+		}
+	}
+
+	value = getenv("GNFP_LOG_MAX_SIZE");
+	if (NULL != value)
+	{
+		s_log.max_size = atol(value);
+	}
+
+	value = getenv("GNFP_LOG_KEEP");
+	if (NULL != value)
+	{
+		s_log.keep = atoi(value);
+	}
+
+	/* Expand "%p" to the process ID so parallel processes never share a file */
+	value = getenv("GNFP_LOG_PATH");
+	if (NULL == value)
+	{
+		value = "gnfingerprint-%p.log";
+	}
+	for (; *value && out < end; value++)
+	{
+		if ('%' == value[0] && 'p' == value[1])
+		{
+			out += snprintf(out, end - out, "%d", (int)getpid());
+			value++;
+		}
+		else
+		{
+			*out++ = *value;
+		}
+	}
+	*(out < end ? out : end) = '\0';
+
+	/* Embedded in another program (e.g. Python), don't take over its handlers */
+	if (0 == sigaction(SIGUSR1, NULL, &action) && SIG_DFL == action.sa_handler)
+	{
+		signal(SIGUSR1, _log_signal_handler);
+	}
+	if (0 == sigaction(SIGUSR2, NULL, &action) && SIG_DFL == action.sa_handler)
+	{
+		signal(SIGUSR2, _log_signal_handler);
+	}
+
+	pthread_mutex_init(&s_log.stop_mutex, NULL);
+	pthread_cond_init(&s_log.stop_cond, NULL);
+	if (0 == pthread_create(&s_log.flusher, NULL, _log_flusher, NULL))
+	{
+		s_log.flusher_running = 1;
+	}
+}
+
+static void
+_log_shutdown(void)
+{
+	unsigned long	dropped	= 0;
+
+	if (s_log.flusher_running)
+	{
+		pthread_mutex_lock(&s_log.stop_mutex);
+		s_log.stop = 1;
+		pthread_cond_signal(&s_log.stop_cond);
+		pthread_mutex_unlock(&s_log.stop_mutex);
+		pthread_join(s_log.flusher, NULL);
+		s_log.flusher_running = 0;
+	}
+	pthread_cond_destroy(&s_log.stop_cond);
+	pthread_mutex_destroy(&s_log.stop_mutex);
+
+	dropped = __atomic_load_n(&s_log.dropped, __ATOMIC_RELAXED);
+	if (dropped > 0)
+	{
+		GNFP_LOG(GNFP_LOG_WARNING, GNFP_EVENT_MESSAGE, dropped, 0, "events dropped, log ring buffer was full");
+	}
+
+	_log_drain();
+
+	if (NULL != s_log.file)
+	{
+		fclose(s_log.file);
+		s_log.file = NULL;
+	}
+}
+
+/*
+*    User registration cache.
+*
+*    The serialized user is stored in "<client_id>_user.txt", shared by every
+*    gnfingerprint process running in the same directory:
+*
+*    - The file is always replaced with write-and-rename, so readers never see a
+*      partially written user and don't need a lock.
+*    - Registration happens under an exclusive fcntl() lock on
+*      "<client_id>_user.txt.lock". A process that finds no usable user takes
+*      the lock, checks the file again (another process may have registered in
+*      the meantime) and only then registers and saves the new user.
+*    - The serialized user is kept in memory, so a process that initializes the
+*      SDK more than once doesn't go back to the file.
+*/
+static struct
+{
+	char*					serialized;			/* Last serialized user seen or written */
+	unsigned long			memory_hits;
+	unsigned long			file_hits;
+	unsigned long			lock_waits;			/* Times we had to take the registration lock */
+	unsigned long			registrations;		/* Times we registered with Gracenote */
+	unsigned long			bad_files;			/* Unreadable or rejected user files */
+} s_user_cache;
+
+static char*
+_user_cache_path(
+	const char*		client_id,
+	const char*		suffix
+	)
+{
+	char*	path	= NULL;
+
+	path = malloc(strlen(client_id) + strlen("_user.txt") + strlen(suffix) + 1);
+	if (NULL != path)
+	{
+		strcpy(path, client_id);
+		strcat(path, "_user.txt");
+		strcat(path, suffix);
+	}
+
+	return path;
+}
+
+/* Reads the whole file at path into a new NUL-terminated string, minus a trailing newline */
+static char*
+_user_cache_read(
+	const char*		path
+	)
+{
+	FILE*		file		= NULL;
+	struct stat	file_stat;
+	char*		contents	= NULL;
+	size_t		read		= 0;
+
+	file = fopen(path, "r");
+	if (NULL == file)
+	{
+		return NULL;
+	}
+
+	if (0 == fstat(fileno(file), &file_stat) && file_stat.st_size > 0)
+	{
+		contents = malloc(file_stat.st_size + 1);
+		if (NULL != contents)
+		{
+			read = fread(contents, 1, file_stat.st_size, file);
+			while (read > 0 && ('\n' == contents[read - 1] || '\r' == contents[read - 1]))
+			{
+				read--;
+			}
+			contents[read] = '\0';
+			if (0 == read)
+			{
+				free(contents);
+				contents = NULL;
+			}
+		}
+	}
+	fclose(file);
+
+	return contents;
+}
+
+/* Atomically replaces the file at path with serialized */
+static int
+_user_cache_write(
+	const char*		path,
+	const char*		serialized
+	)
+{
+	char*	tmp_path	= NULL;
+	FILE*	file		= NULL;
+	int		rc			= 0;
+
+	tmp_path = malloc(strlen(path) + 32);
+	if (NULL == tmp_path)
+	{
+		printf("Error allocating memory.\n");
+		return -1;
+	}
+	sprintf(tmp_path, "%s.%d.tmp", path, (int)getpid());
+
+	file = fopen(tmp_path, "w");
+	if (NULL == file)
+	{
+		printf("\nError: Failed to open the user filename for use in saving the updated serialized user. (%s)\n", tmp_path);
+		free(tmp_path);
+		return -1;
+	}
+
+	if (0 > fputs(serialized, file) || 0 != fflush(file) || 0 != fsync(fileno(file)))
+	{
+		printf("Error writing user registration file from buffer.\n");
+		rc = -1;
+	}
+	if (0 != fclose(file))
+	{
+		rc = -1;
+	}
+
+	if (0 == rc && 0 != rename(tmp_path, path))
+	{
+		printf("\nError: Failed to replace the user registration file. (%s)\n", path);
+		rc = -1;
+	}
+	if (0 != rc)
+	{
+		remove(tmp_path);
+	}
+
+	free(tmp_path);
+	return rc;
+}
+
+/* Takes (F_WRLCK) or releases (F_UNLCK) the registration lock; returns the lock fd or -1 */
+static int
+_user_cache_lock(
+	const char*		lock_path,
+	int				fd,
+	short			type
+	)
+{
+	struct flock	lock;
+
+	if (-1 == fd)
+	{
+		fd = open(lock_path, O_RDWR | O_CREAT, 0644);
+		if (-1 == fd)
+		{
+			return -1;
+		}
+	}
+
+	memset(&lock, 0, sizeof(lock));
+	lock.l_type = type;
+	lock.l_whence = SEEK_SET;
+
+	while (-1 == fcntl(fd, F_SETLKW, &lock))
+	{
+		if (EINTR != errno)
+		{
+			close(fd);
+			return -1;
+		}
+	}
+
+	if (F_UNLCK == type)
+	{
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+static void
+_user_cache_remember(
+	const char*		serialized
+	)
+{
+	char*	copy	= NULL;
+
+	if (NULL != s_user_cache.serialized && 0 == strcmp(s_user_cache.serialized, serialized))
+	{
+		return;
+	}
+
+	copy = malloc(strlen(serialized) + 1);
+	if (NULL != copy)
+	{
+		strcpy(copy, serialized);
+		free(s_user_cache.serialized);
+		s_user_cache.serialized = copy;
+	}
+}
+
+/* Creates a user handle from serialized; on failure the user is treated as missing */
+static gnsdk_user_handle_t
+_user_cache_create(
+	const char*		serialized
+	)
+{
+	gnsdk_error_t		error		= GNSDK_SUCCESS;
+	gnsdk_user_handle_t	user_handle	= GNSDK_NULL;
+
+	if (NULL == serialized)
+	{
+		return GNSDK_NULL;
+	}
+
+	error = gnsdk_manager_user_create(serialized, &user_handle);
+	if (GNSDK_SUCCESS != error)
+	{
+		_display_error(__LINE__, "gnsdk_manager_user_create()", error);
+		s_user_cache.bad_files++;
+		return GNSDK_NULL;
+	}
+
+	_user_cache_remember(serialized);
+	return user_handle;
+}
+
+/*
+*    Registers a new user and saves it right away, so that processes waiting
+*    on the registration lock can use it instead of registering again.
+*/
+static int
+_user_cache_register(
+	const char*				user_filename,
+	const char*				client_id,
+	const char*				client_id_tag,
+	const char*				client_app_version,
+	gnsdk_user_handle_t*	p_user_handle
+	)
+{
+	gnsdk_error_t		error			= GNSDK_SUCCESS;
+	gnsdk_user_handle_t	user_handle		= GNSDK_NULL;
+	gnsdk_str_t			serialized		= GNSDK_NULL;
+
+	GNFP_LOG(GNFP_LOG_WARNING, GNFP_EVENT_MESSAGE, s_user_cache.registrations + 1, 0, "registering new Gracenote user");
+
+	error = gnsdk_manager_user_create_new(
+				client_id,
+				client_id_tag,
+				client_app_version,
+				&user_handle
+				);
+	if (GNSDK_SUCCESS != error)
+	{
+		_display_error(__LINE__, "gnsdk_manager_user_create_new()", error);
+		return -1;
+	}
+	s_user_cache.registrations++;
+
+	/* Releasing the new user hands back its serialized form */
+	error = gnsdk_manager_user_release(user_handle, &serialized);
+	if (GNSDK_SUCCESS != error)
+	{
+		_display_error(__LINE__, "gnsdk_manager_user_release()", error);
+		return -1;
+	}
+	if (GNSDK_NULL == serialized)
+	{
+		printf("\nError: gnsdk_manager_user_release() returned no serialized user.\n");
+		GNFP_LOG(GNFP_LOG_ERROR, GNFP_EVENT_MESSAGE, s_user_cache.registrations, __LINE__, "registered Gracenote user was not serialized");
+		return -1;
+	}
+
+	/* The user still works in this process; other processes will register again */
+	if (0 != _user_cache_write(user_filename, serialized))
+	{
+		GNFP_LOG(GNFP_LOG_ERROR, GNFP_EVENT_MESSAGE, s_user_cache.registrations, __LINE__, "failed to save the registered Gracenote user");
+	}
+	*p_user_handle = _user_cache_create(serialized);
+	gnsdk_manager_string_free(serialized);
+
+	return (GNSDK_NULL == *p_user_handle) ? -1 : 0;
+}
+
+/*
+*    Load existing user handle, or register new one.
+*
+*    GNSDK requires a user handle instance to perform queries.
+*    User handles encapsulate your Gracenote provided Client ID which is unique for your
+*    application. User handles are registered once with Gracenote then must be saved by
+*    your application and reused on future invocations.
+*/
+static int
+_get_user_handle(
+	const char*				client_id,
+	const char*				client_id_tag,
+	const char*				client_app_version,
+	gnsdk_user_handle_t*	p_user_handle
+	)
+{
+	gnsdk_user_handle_t	user_handle			= GNSDK_NULL;
+	char*				user_filename		= NULL;
+	char*				lock_filename		= NULL;
+	char*				serialized			= NULL;
+	int					lock_fd				= -1;
+	int					rc					= 0;
+
+	/* Fast path: a user we already loaded in this process */
+	user_handle = _user_cache_create(s_user_cache.serialized);
+	if (GNSDK_NULL != user_handle)
+	{
+		s_user_cache.memory_hits++;
+		*p_user_handle = user_handle;
+		return 0;
+	}
+
+	user_filename = _user_cache_path(client_id, "");
+	lock_filename = _user_cache_path(client_id, ".lock");
+	if (NULL == user_filename || NULL == lock_filename)
+	{
+		printf("Error allocating memory.\n");
+		free(user_filename);
+		free(lock_filename);
+		return -1;
+	}
+
+	/* Do we have a user saved locally? The file is replaced atomically, so no lock is needed to read it */
+	serialized = _user_cache_read(user_filename);
+	user_handle = _user_cache_create(serialized);
+	free(serialized);
+
+	/* If not, take the registration lock and check again before creating a new one */
+	if (GNSDK_NULL == user_handle)
+	{
+		GNFP_LOG(GNFP_LOG_INFO, GNFP_EVENT_MESSAGE, 0, 0, "no stored user, taking registration lock");
+		s_user_cache.lock_waits++;
+		lock_fd = _user_cache_lock(lock_filename, -1, F_WRLCK);
+		if (-1 == lock_fd)
+		{
+			printf("\nError: Failed to lock the user registration file. (%s)\n", lock_filename);
+		}
+
+		serialized = _user_cache_read(user_filename);
+		user_handle = _user_cache_create(serialized);
+		free(serialized);
+
+		if (GNSDK_NULL == user_handle)
+		{
+			rc = _user_cache_register(
+					user_filename,
+					client_id,
+					client_id_tag,
+					client_app_version,
+					&user_handle
+					);
+		}
+		else
+		{
+			s_user_cache.file_hits++;
+		}
+
+		if (-1 != lock_fd)
+		{
+			_user_cache_lock(lock_filename, lock_fd, F_UNLCK);
+		}
+	}
+	else
+	{
+		s_user_cache.file_hits++;
+	}
+
+	free(user_filename);
+	free(lock_filename);
+
+	if (rc == 0)
+	{
+		*p_user_handle = user_handle;
+	}
+
+	return rc;
+}
+
+/*
+*    Saves an updated serialized user, if it changed, and logs the cache counters.
+*/
+static void
+_save_user(
+	const char*		client_id,
+	const char*		serialized
+	)
+{
+	char*	user_filename	= NULL;
+	char*	lock_filename	= NULL;
+	int		lock_fd			= -1;
+	char	counters[GNFP_LOG_TEXT_SIZE];
+
+	if (NULL != serialized && (NULL == s_user_cache.serialized || 0 != strcmp(s_user_cache.serialized, serialized)))
+	{
+		user_filename = _user_cache_path(client_id, "");
+		lock_filename = _user_cache_path(client_id, ".lock");
+		if (NULL != user_filename && NULL != lock_filename)
+		{
+			lock_fd = _user_cache_lock(lock_filename, -1, F_WRLCK);
+			if (0 != _user_cache_write(user_filename, serialized))
+			{
+				GNFP_LOG(GNFP_LOG_ERROR, GNFP_EVENT_MESSAGE, 0, __LINE__, "failed to save the updated Gracenote user");
+			}
+			if (-1 != lock_fd)
+			{
+				_user_cache_lock(lock_filename, lock_fd, F_UNLCK);
+			}
+			_user_cache_remember(serialized);
+		}
+		else
+		{
+			printf("\nError: Failed to allocated user filename for us in saving the updated serialized user.\n");
+		}
+		free(user_filename);
+		free(lock_filename);
+	}
+
+	snprintf(counters, sizeof(counters),
+		"user cache: memory_hits=%lu file_hits=%lu lock_waits=%lu registrations=%lu bad_files=%lu",
+		s_user_cache.memory_hits,
+		s_user_cache.file_hits,
+		s_user_cache.lock_waits,
+		s_user_cache.registrations,
+		s_user_cache.bad_files
+		);
+	GNFP_LOG(GNFP_LOG_INFO, GNFP_EVENT_MESSAGE, s_user_cache.registrations, 0, counters);
+}
+
+/*
+*    Display product version information.
+*/
+static void
+_display_gnsdk_product_info(void)
+{
+	/* Display GNSDK Version infomation */
+	printf("\nGNSDK Product Version    : v%s \t(built %s)\n", gnsdk_manager_get_product_version(), gnsdk_manager_get_build_date());
+}
+
+/*
+*  Enable GNSDK's own logging.
+*
+*  Errors reported through _display_error() already reach our log, so the SDK's
+*  internal log is only written at the debug level. It goes next to our log
+*  file (so it is per-process too) and is rotated instead of truncated.
+*/
+static int
+_enable_logging(void)
+{
+	gnsdk_error_t	error	= GNSDK_SUCCESS;
+	int				rc		= 0;
+	char			path[1040];
+
+	if (s_log_level < GNFP_LOG_DEBUG)
+	{
+		return 0;
+	}
+
+	snprintf(path, sizeof(path), "%s.gnsdk", s_log.path);
+
+	error = gnsdk_manager_logging_enable(
+				path,											/* Log file path */
+				GNSDK_LOG_PKG_ALL,								/* Include entries for all packages and subsystems */
+				GNSDK_LOG_LEVEL_ALL,							/* Include all entries */
+				GNSDK_LOG_OPTION_ALL,							/* All logging options: timestamps, thread IDs, etc */
+				s_log.max_size,									/* Max size of log before it is rotated */
+				GNSDK_TRUE										/* GNSDK_TRUE = old logs will be renamed and saved */
+				);
+	if (GNSDK_SUCCESS != error)
+	{
+		_display_error(__LINE__, "gnsdk_manager_logging_enable()", error);
+		rc = -1;
+	}
+
+	return rc;
+}
+
+/*
+* Set the application Locale.
+*/
+static int
+_set_locale(
+	gnsdk_user_handle_t		user_handle
+	)
+{
+	gnsdk_locale_handle_t	locale_handle	= GNSDK_NULL;
+	gnsdk_error_t			error			= GNSDK_SUCCESS;
+	int						rc				= 0;
+
+	error = gnsdk_manager_locale_load(
+				GNSDK_LOCALE_GROUP_MUSIC,		/* Locale group */
+				GNSDK_LANG_ENGLISH,				/* Languae */
+				GNSDK_REGION_DEFAULT,			/* Region */
+				GNSDK_DESCRIPTOR_SIMPLIFIED,	/* Descriptor */
+				user_handle,					/* User handle */
+				GNSDK_NULL,						/* User callback function */
+				0,								/* Optional data for user callback function */
+				&locale_handle					/* Return handle */
+				);
+	if (GNSDK_SUCCESS == error)
+	{
+		/* Setting the 'locale' as default
+		 * If default not set, no locale-specific results would be available
+		 */
+		error = gnsdk_manager_locale_set_group_default(locale_handle);
+		if (GNSDK_SUCCESS != error)
+		{
+			_display_error(__LINE__, "gnsdk_manager_locale_set_group_default()", error);
+			rc = -1;
+		}
+
+		/* The manager will hold onto the locale when set as default
+		 * so it's ok to release our reference to it here
+		 */
+		gnsdk_manager_locale_release(locale_handle);
+	}
+	else
+	{
+		_display_error(__LINE__, "gnsdk_manager_locale_load()", error);
+		rc = -1;
+	}
+
+	return rc;
+}
+
+/*
+*     Initializing the GNSDK is required before any other APIs can be called.
+*     First step is to always initialize the Manager module, then use the returned
+*     handle to initialize any modules to be used by the application.
+*
+*     For this sample, we also load a locale which is used by GNSDK to provide
+*     appropriate locale-sensitive metadata for certain metadata values. Loading of the
+*     locale is done here for sample convenience but can be done at anytime in your
+*     application.
+*/
+static int
+_init_gnsdk(
+	const char*				client_id,
+	const char*				client_id_tag,
+	const char*				client_app_version,
+	const char*				license_path,
+	gnsdk_user_handle_t*	p_user_handle
+	)
+{
+	gnsdk_manager_handle_t	sdkmgr_handle	= GNSDK_NULL;
+	gnsdk_error_t			error			= GNSDK_SUCCESS;
+	gnsdk_user_handle_t		user_handle		= GNSDK_NULL;
+	int						rc				= 0;
+
+	/* Display GNSDK Product Version Info */
+	/* _display_gnsdk_product_info(); */
+
+	/* Initialize the GNSDK Manager */
+	error = gnsdk_manager_initialize(
+				&sdkmgr_handle,
+				license_path,
+				GNSDK_MANAGER_LICENSEDATA_FILENAME
+				);
+	if (GNSDK_SUCCESS != error)
+	{
+		_display_error(__LINE__, "gnsdk_manager_initialize()", error);
+		rc = -1;
+	}
+
+	/* Enable logging */
+	if (0 == rc)
+	{
+		rc = _enable_logging();
+	}
+
+	/* Initialize the Storage SQLite Library */
+	if (0 == rc)
+	{
+		error = gnsdk_storage_sqlite_initialize(sdkmgr_handle);
+		if (GNSDK_SUCCESS != error)
+		{
+			_display_error(__LINE__, "gnsdk_storage_sqlite_initialize()", error);
+			rc = -1;
+		}
+	}
+
+	/* Initialize the DSP Library - used for generating fingerprints */
+	if (0 == rc)
+	{
+		error = gnsdk_dsp_initialize(sdkmgr_handle);
+		if (GNSDK_SUCCESS != error)
+		{
+			_display_error(__LINE__, "gnsdk_dsp_initialize()", error);
+			rc = -1;
+		}
+	}
+
+	/* Initialize the MusicID Library */
+	if (0 == rc)
+	{
+		error = gnsdk_musicid_initialize(sdkmgr_handle);
+		if (GNSDK_SUCCESS != error)
+		{
+			_display_error(__LINE__, "gnsdk_musicid_initialize()", error);
+			rc = -1;
+		}
+	}
+
+	/* Get a user handle for our client ID.  This will be passed in for all queries */
+	if (0 == rc)
+	{
+		rc = _get_user_handle(
+				client_id,
+				client_id_tag,
+				client_app_version,
+				&user_handle
+				);
+	}
+
+	/* Set the 'locale' to return locale-specifc results values. This examples loads an English locale. */
+	if (0 == rc)
+	{
+		rc = _set_locale(user_handle);
+	}
+
+	if (0 != rc)
+	{
+		/* Clean up on failure. */
+		_shutdown_gnsdk(user_handle, client_id);
+	}
+	else
+	{
+		/* return the User handle for use at query time */
+		*p_user_handle = user_handle;
+	}
+
+	return rc;
+}
+
+/*
+*     Call shutdown all initialized GNSDK modules.
+*     Release all existing handles before shutting down any of the modules.
+*     Shutting down the Manager module should occur last, but the shutdown ordering of
+*     all other modules does not matter.
+*/
+static void
+_shutdown_gnsdk(
+	gnsdk_user_handle_t		user_handle,
+	const char*				client_id
+	)
+{
+	gnsdk_error_t	error							= GNSDK_SUCCESS;
+	gnsdk_str_t		updated_serialized_user_string	= GNSDK_NULL;
+
+	/* Release our user handle and see if we need to update our stored version */
+	error = gnsdk_manager_user_release(user_handle, &updated_serialized_user_string);
+	if (GNSDK_SUCCESS != error)
+	{
+		_display_error(__LINE__, "gnsdk_manager_user_release()", error);
+	}
+	else
+	{
+		_save_user(client_id, updated_serialized_user_string);
+		if (GNSDK_NULL != updated_serialized_user_string)
+		{
+			gnsdk_manager_string_free(updated_serialized_user_string);
+		}
+	}
+
+	/* Shutdown the libraries */
+	gnsdk_dsp_shutdown();
+	gnsdk_musicid_shutdown();
+	gnsdk_storage_sqlite_shutdown();
+	gnsdk_manager_shutdown();
+}
+
+/* Copies the track's artist, album and title into result */
+static void
+_get_track_gdo(
+	gnsdk_gdo_handle_t	track_gdo,
+	gnfp_result_t*		result
+	)
+{
+	gnsdk_error_t		error		= GNSDK_SUCCESS;
+	gnsdk_gdo_handle_t	title_gdo	= GNSDK_NULL;
+	gnsdk_gdo_handle_t	album_gdo	= GNSDK_NULL;
+	gnsdk_gdo_handle_t	artist_gdo	= GNSDK_NULL;
+	gnsdk_cstr_t		value		= GNSDK_NULL;
+
+	/* track Artist */
+	error = gnsdk_manager_gdo_child_get( track_gdo, GNSDK_GDO_CHILD_ARTIST, 1, &artist_gdo );
+	if (GNSDK_SUCCESS == error)
+	{
+		error = gnsdk_manager_gdo_child_get( artist_gdo, GNSDK_GDO_CHILD_NAME_OFFICIAL, 1, &title_gdo );
+		if (GNSDK_SUCCESS == error)
+		{
+			error = gnsdk_manager_gdo_value_get( title_gdo, GNSDK_GDO_VALUE_DISPLAY, 1, &value );
+			if (GNSDK_SUCCESS == error)
+			{
+				snprintf( result->artist, sizeof(result->artist), "%s", value );
+			}
+			else
+			{
+				_display_error(__LINE__, "gnsdk_manager_gdo_value_get(GNSDK_GDO_VALUE_DISPLAY artist)", error);
+			}
+			gnsdk_manager_gdo_release(title_gdo);
+		}
+		else
+		{
+			_display_error(__LINE__, "gnsdk_manager_gdo_child_get(GNSDK_GDO_CHILD_TITLE_OFFICIAL artist)", error);
+		}
+		gnsdk_manager_gdo_release(artist_gdo);
+	}
+	else
+	{
+		_display_error(__LINE__, "gnsdk_manager_gdo_child_get(GNSDK_GDO_CHILD_ALBUM track)", error);
+	}
+
+	/* track Album */
+	error = gnsdk_manager_gdo_child_get( track_gdo, GNSDK_GDO_CHILD_ALBUM, 1, &album_gdo );
+	if (GNSDK_SUCCESS == error)
+	{
+		error = gnsdk_manager_gdo_child_get( album_gdo, GNSDK_GDO_CHILD_TITLE_OFFICIAL, 1, &title_gdo );
+		if (GNSDK_SUCCESS == error)
+		{
+			error = gnsdk_manager_gdo_value_get( title_gdo, GNSDK_GDO_VALUE_DISPLAY, 1, &value );
+			if (GNSDK_SUCCESS == error)
+			{
+				snprintf( result->album, sizeof(result->album), "%s", value );
+			}
+			else
+			{
+				_display_error(__LINE__, "gnsdk_manager_gdo_value_get(GNSDK_GDO_VALUE_DISPLAY album)", error);
+			}
+			gnsdk_manager_gdo_release(title_gdo);
+		}
+		else
+		{
+			_display_error(__LINE__, "gnsdk_manager_gdo_child_get(GNSDK_GDO_CHILD_TITLE_OFFICIAL album)", error);
+		}
+		gnsdk_manager_gdo_release(album_gdo);
+	}
+	else
+	{
+		_display_error(__LINE__, "gnsdk_manager_gdo_child_get(GNSDK_GDO_CHILD_ALBUM track)", error);
+	}
+
+	/* track Title */
+	error = gnsdk_manager_gdo_child_get( track_gdo, GNSDK_GDO_CHILD_TITLE_OFFICIAL, 1, &title_gdo );
+	if (GNSDK_SUCCESS == error)
+	{
+		error = gnsdk_manager_gdo_value_get( title_gdo, GNSDK_GDO_VALUE_DISPLAY, 1, &value );
+		if (GNSDK_SUCCESS == error)
+		{
+			snprintf( result->title, sizeof(result->title), "%s", value );
+		}
+		else
+		{
+			_display_error(__LINE__, "gnsdk_manager_gdo_value_get()", error);
+		}
+		gnsdk_manager_gdo_release(title_gdo);
+	}
+	else
+	{
+		_display_error(__LINE__, "gnsdk_manager_gdo_child_get()", error);
+	}
+}
+
+static void
+_display_for_resolve(
+	gnsdk_gdo_handle_t		response_gdo
+	)
+{
+	gnsdk_error_t			error				= GNSDK_SUCCESS;
+	gnsdk_gdo_handle_t		track_gdo			= GNSDK_NULL;
+	gnsdk_uint32_t			track_count			= 0;
+	gnsdk_uint32_t			track_ordinal		= 0;
+	gnfp_result_t			track;
+
+	error = gnsdk_manager_gdo_child_count(response_gdo, GNSDK_GDO_CHILD_TRACK, &track_count);
+	if (GNSDK_SUCCESS == error)
+	{
+		printf( "%16s %d\n", "Match count:", track_count);
+
+		/*	Note that the GDO accessors below are *ordinal* based, not index based.  so the 'first' of
+			*	anything has a one-based ordinal of '1' - *not* an index of '0'
+			*/
+		for (track_ordinal = 1; track_ordinal <= track_count; track_ordinal++)
+		{
+			/* Get the track GDO */
+			error = gnsdk_manager_gdo_child_get( response_gdo, GNSDK_GDO_CHILD_TRACK, track_ordinal, &track_gdo );
+			if (GNSDK_SUCCESS == error)
+			{
+				memset(&track, 0, sizeof(track));
+				_get_track_gdo(track_gdo, &track);
+				printf( "%16s %s\n", "Artist:", track.artist );
+				printf( "%16s %s\n", "Album:", track.album );
+				printf( "%16s %s\n", "Title:", track.title );
+
+				/* Release the current track */
+				gnsdk_manager_gdo_release(track_gdo);
+				track_gdo = GNSDK_NULL;
+			}
+			else
+			{
+				_display_error(__LINE__, "gnsdk_manager_gdo_child_get()", error);
+			}
+		}
+	}
+	else
+	{
+		_display_error(__LINE__, "gnsdk_manager_gdo_child_count()", error);
+	}
+}
+
+static gnsdk_uint32_t
+_do_match_selection(gnsdk_gdo_handle_t response_gdo)
+{
+	/*
+	This is where any matches that need resolution/disambiguation are iterated
+	and a single selection of the best match is made.
+
+	For this simplified sample, we'll just echo the matches and select the first match.
+	*/
+	/* _display_for_resolve(response_gdo); */
+
+	return 1;
+}
+
+/* This function streams PCM audio into the Query handle to generate the query fingerprint */
+static int
+_set_query_fingerprint(
+	gnsdk_musicid_query_handle_t	query_handle,
+	long long						window_index,
+	const char*						pcm_audio,
+	size_t							pcm_length,
+	unsigned int					sample_rate,
+	unsigned int					sample_bits,
+	unsigned int					channels
+	)
+{
+	gnsdk_error_t				error					= GNSDK_SUCCESS;
+	gnsdk_bool_t 				blocks_complete			= GNSDK_FALSE;
+	size_t						offset					= 0;
+	size_t						write_len				= 0;
+	int							rc						= 0;
+
+	GNFP_LOG(GNFP_LOG_DEBUG, GNFP_EVENT_WINDOW_BEGIN, window_index, 0, GNSDK_NULL);
+
+	 /* initialize the fingerprinter */
+	error = gnsdk_musicid_query_fingerprint_begin(
+				query_handle,
+				GNSDK_MUSICID_FP_DATA_TYPE_GNFPX,
+				sample_rate,
+				sample_bits,
+				channels
+				);
+	if (GNSDK_SUCCESS != error)
+	{
+		_display_error(__LINE__, "gnsdk_musicidfile_fileinfo_fingerprint_begin()", error);
+		return -1;
+	}
+
+	while (offset < pcm_length && !blocks_complete)
+	{
+		write_len = pcm_length - offset;
+		if (write_len > 16384)
+		{
+			write_len = 16384;
+		}
+
+		 /* write audio to the fingerprinter */
+		error = gnsdk_musicid_query_fingerprint_write(
+					query_handle,
+					pcm_audio + offset,
+					write_len,
+					&blocks_complete
+					);
+		if (GNSDK_SUCCESS != error)
+		{
+			if (GNSDKERR_SEVERE(error)) /* 'aborted' warnings could come back from write which should be expected */
+			{
+				_display_error(__LINE__, "gnsdk_musicidfile_fileinfo_fingerprint_write()", error);
+			}
+			rc = -1;
+			break;
+		}
+
+		offset += write_len;
+	}
+
+	GNFP_LOG(GNFP_LOG_DEBUG, GNFP_EVENT_WINDOW_END, window_index, offset, GNSDK_NULL);
+
+	 /*signal that we are done*/
+	if (GNSDK_SUCCESS == error)
+	{
+		error = gnsdk_musicid_query_fingerprint_end(query_handle);
+		if (GNSDK_SUCCESS != error)
+		{
+			_display_error(__LINE__, "gnsdk_musicidfile_fileinfo_fingerprint_end()", error);
+		}
+	}
+
+	return rc;
+}
+
+/*
+ * Looks up the fingerprint set on the query handle and fills result with
+ * the best matching track.
+ */
+static int
+_find_track(
+	gnsdk_musicid_query_handle_t	query_handle,
+	long long						window_index,
+	gnfp_result_t*					result
+	)
+{
+	gnsdk_error_t						error = GNSDK_SUCCESS;
+	gnsdk_gdo_handle_t					response_gdo = GNSDK_NULL;
+	gnsdk_gdo_handle_t					track_gdo = GNSDK_NULL;
+	gnsdk_gdo_handle_t					followup_response_gdo = GNSDK_NULL;
+	gnsdk_uint32_t						count					= 0;
+	gnsdk_uint32_t						choice_ordinal			= 0;
+	gnsdk_cstr_t						needs_decision			= GNSDK_NULL;
+	gnsdk_cstr_t						is_full					= GNSDK_NULL;
+
+	/* Perform the query */
+	GNFP_LOG(GNFP_LOG_DEBUG, GNFP_EVENT_QUERY_BEGIN, window_index, 0, GNSDK_NULL);
+	error = gnsdk_musicid_query_find_tracks(
+				query_handle,
+				&response_gdo
+				);
+	if (GNSDK_SUCCESS != error)
+	{
+		_display_error(__LINE__, "gnsdk_musicid_query_find_tracks()", error);
+	}
+
+	/* See how many tracks were found. */
+	if (GNSDK_SUCCESS == error)
+	{
+		error = gnsdk_manager_gdo_child_count(
+						response_gdo,
+						GNSDK_GDO_CHILD_TRACK,
+						&count
+						);
+		if (GNSDK_SUCCESS != error)
+		{
+			_display_error(__LINE__, "gnsdk_manager_gdo_child_count(GNSDK_GDO_CHILD_TRACK)", error);
+		}
+		GNFP_LOG(GNFP_LOG_DEBUG, GNFP_EVENT_QUERY_END, window_index, count, GNSDK_NULL);
+	}
+
+	/* See if we need any follow-up queries or disambiguation */
+	if (GNSDK_SUCCESS == error)
+	{
+		if (count == 0)
+		{
+			result->matched = 0;
+		}
+		else
+		{
+			/* we have at least one track, see if disambiguation (match resolution) is necessary. */
+			error = gnsdk_manager_gdo_value_get(
+						response_gdo,
+						GNSDK_GDO_VALUE_RESPONSE_NEEDS_DECISION,
+						1,
+						&needs_decision
+						);
+			if (GNSDK_SUCCESS != error)
+			{
+				_display_error(__LINE__, "gnsdk_manager_gdo_value_get(GNSDK_GDO_VALUE_RESPONSE_NEEDS_DECISION)", error);
+			}
+			else
+			{
+				/* See if selection of one of the tracks needs to happen */
+				if (0 == strcmp(needs_decision, GNSDK_VALUE_TRUE))
+				{
+					choice_ordinal = _do_match_selection(response_gdo);
+				}
+				else
+				{
+					/* no need for disambiguation, we'll take the first track */
+					choice_ordinal = 1;
+				}
+
+				error = gnsdk_manager_gdo_child_get(
+							response_gdo,
+							GNSDK_GDO_CHILD_TRACK,
+							choice_ordinal,
+							&track_gdo
+							);
+				if (GNSDK_SUCCESS != error)
+				{
+					_display_error(__LINE__, "gnsdk_manager_gdo_child_get(GNSDK_GDO_CHILD_TRACK)", error);
+				}
+				else
+				{
+					/* See if the track has full data or only partial data. */
+					error = gnsdk_manager_gdo_value_get(
+								track_gdo,
+								GNSDK_GDO_VALUE_FULL_RESULT,
+								1,
+								&is_full
+								);
+					if (GNSDK_SUCCESS != error)
+					{
+						_display_error(__LINE__, "gnsdk_manager_gdo_value_get(GNSDK_GDO_VALUE_FULL_RESULT)", error);
+					}
+					else
+					{
+						/* if we only have a partial result, we do a follow-up query to retrieve the full track */
+						if (0 == strcmp(is_full, GNSDK_VALUE_FALSE))
+						{
+							/* do followup query to get full object. Setting the partial track as the query input. */
+							error = gnsdk_musicid_query_set_gdo(
+										query_handle,
+										track_gdo
+										);
+							if (GNSDK_SUCCESS != error)
+							{
+								_display_error(__LINE__, "gnsdk_musicid_query_set_gdo()", error);
+							}
+							else
+							{
+								/* we can now release the partial track */
+								gnsdk_manager_gdo_release(track_gdo);
+								track_gdo = GNSDK_NULL;
+
+								error = gnsdk_musicid_query_find_tracks(
+											query_handle,
+											&followup_response_gdo
+											);
+								if (GNSDK_SUCCESS != error)
+								{
+									_display_error(__LINE__, "gnsdk_musicid_query_find_tracks()", error);
+								}
+								else
+								{
+									/* now our first track is the desired result with full data */
+									error = gnsdk_manager_gdo_child_get(
+												followup_response_gdo,
+												GNSDK_GDO_CHILD_TRACK,
+												1,
+												&track_gdo
+												);
+
+									/* Release the followup query's response object */
+									gnsdk_manager_gdo_release(followup_response_gdo);
+								}
+							}
+						}
+					}
+
+					/* We should now have our final, full track result. */
+					if (GNSDK_SUCCESS == error)
+					{
+						result->matched = 1;
+						_get_track_gdo(track_gdo, result);
+					}
+
+					gnsdk_manager_gdo_release(track_gdo);
+					track_gdo = GNSDK_NULL;
+				 }
+			}
+		}
+	}
+
+	/* Release the results */
+	if (GNSDK_NULL != response_gdo)
+	{
+		gnsdk_manager_gdo_release(response_gdo);
+	}
+
+	return (GNSDK_SUCCESS == error) ? 0 : -1;
+}
+
+/*
+ * This function performs a fingerprint lookup. Safe to call from several
+ * threads at once, each call uses its own query handle.
+ */
+static int
+_do_sample_musicid_stream(
+	gnsdk_user_handle_t     user_handle,
+	const char*				pcm_audio,
+	size_t					pcm_length,
+	unsigned int			sample_rate,
+	unsigned int			sample_bits,
+	unsigned int			channels,
+	gnfp_result_t*			result
+	)
+{
+	gnsdk_error_t						error = GNSDK_SUCCESS;
+	gnsdk_musicid_query_handle_t		query_handle = GNSDK_NULL;
+	long long							window_index			= 0;
+	int									rc						= 0;
+
+	window_index = __atomic_fetch_add(&s_window_index, 1, __ATOMIC_RELAXED);
+
+	/* printf("\n*****Sample MID-Stream Query*****\n"); */
+
+	/* Create the query handle */
+	error = gnsdk_musicid_query_create(
+				user_handle,
+				GNSDK_NULL,	 /* User callback function */
+				GNSDK_NULL,	 /* Optional data to be passed to the callback */
+				&query_handle
+				);
+	if (GNSDK_SUCCESS != error)
+	{
+		_display_error(__LINE__, "gnsdk_musicid_query_create()", error);
+		return -1;
+	}
+
+	/* Set the input fingerprint. */
+	rc = _set_query_fingerprint(
+			query_handle,
+			window_index,
+			pcm_audio,
+			pcm_length,
+			sample_rate,
+			sample_bits,
+			channels
+			);
+
+	if (0 == rc)
+	{
+		rc = _find_track(query_handle, window_index, result);
+	}
+
+	/* Clean up */
+	/* Release the query handle */
+	gnsdk_musicid_query_release(query_handle);
+
+	return rc;
+}
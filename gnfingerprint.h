@@ -0,0 +1,165 @@
+/*
+ *  Name: gnfingerprint
+ *  Description:
+ *  Identifies music in raw PCM audio with MusicID-Stream, in-process.
+ *
+ *  A session initializes GNSDK and holds the Gracenote user. One session can
+ *  be open per process at a time. While it is open, gnfp_identify() may be
+ *  called from any number of threads at once: every call fingerprints its
+ *  buffer and queries with its own query handle.
+ *
+ *		gnfp_session_t*	session	= NULL;
+ *		gnfp_result_t	result;
+ *
+ *		if (GNFP_SUCCESS == gnfp_session_open(client_id, client_id_tag, "1", license_path, &session))
+ *		{
+ *			if (GNFP_SUCCESS == gnfp_identify(session, pcm, pcm_length, 44100, 16, 2, &result) && result.matched)
+ *			{
+ *				printf("%s - %s\n", result.artist, result.title);
+ *			}
+ *			gnfp_session_close(session);
+ *		}
+ *
+ *  Errors are printed to stderr and logged; the log is configured with the
+ *  GNFP_LOG_* environment variables described in gnfingerprint.c.
+*/
+
+#ifndef _GNFINGERPRINT_H_
+#define _GNFINGERPRINT_H_
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Return codes */
+#define GNFP_SUCCESS			0
+#define GNFP_ERROR				-1		/* Details were printed to stderr and logged */
+#define GNFP_BUSY				-2		/* Another session is already open in this process */
+
+/* Log levels, see gnfp_log() */
+#define GNFP_LOG_NONE			0
+#define GNFP_LOG_ERROR			1
+#define GNFP_LOG_WARNING		2
+#define GNFP_LOG_INFO			3
+#define GNFP_LOG_DEBUG			4
+
+#define GNFP_RESULT_TEXT_SIZE	256
+
+typedef struct gnfp_session_s	gnfp_session_t;
+
+typedef struct
+{
+	int						matched;		/* 0 when no track was found */
+	char					artist[GNFP_RESULT_TEXT_SIZE];
+	char					album[GNFP_RESULT_TEXT_SIZE];
+	char					title[GNFP_RESULT_TEXT_SIZE];
+} gnfp_result_t;
+
+/*
+*  Initializes GNSDK and gets a user handle, registering a new Gracenote user
+*  only if none is cached (see the user registration cache in gnfingerprint.c).
+*/
+int
+gnfp_session_open(
+	const char*				client_id,
+	const char*				client_id_tag,
+	const char*				client_app_version,
+	const char*				license_path,
+	gnfp_session_t**		p_session
+	);
+
+/*
+*  Saves the user if GNSDK updated it and shuts GNSDK down. No gnfp_identify()
+*  call may be running on the session.
+*/
+void
+gnfp_session_close(
+	gnfp_session_t*			session
+	);
+
+/*
+*  Fingerprints pcm_length bytes of interleaved little-endian PCM and looks
+*  the fingerprint up. Returns GNFP_SUCCESS when the lookup completed, whether
+*  or not it matched; result->matched says which.
+*/
+int
+gnfp_identify(
+	gnfp_session_t*			session,
+	const void*				pcm,
+	size_t					pcm_length,
+	unsigned int			sample_rate,
+	unsigned int			sample_bits,
+	unsigned int			channels,
+	gnfp_result_t*			result
+	);
+
+/*
+*  Fingerprint export and deferred lookup
+*
+*  gnfp_fingerprint() only generates the fingerprint of a buffer, without
+*  touching the network. Its data can be stored and looked up later, on
+*  another machine, with a lookup handle. A lookup handle owns one query
+*  handle that is reused for every lookup, so it must only be used by one
+*  thread at a time; open one per worker.
+*/
+typedef struct gnfp_lookup_s	gnfp_lookup_t;
+
+/*
+*  Fingerprints pcm_length bytes of PCM like gnfp_identify() but doesn't look
+*  the fingerprint up. On success *p_fp_data is a NUL-terminated string of
+*  *p_fp_length bytes that the caller releases with free().
+*/
+int
+gnfp_fingerprint(
+	gnfp_session_t*			session,
+	const void*				pcm,
+	size_t					pcm_length,
+	unsigned int			sample_rate,
+	unsigned int			sample_bits,
+	unsigned int			channels,
+	char**					p_fp_data,
+	size_t*					p_fp_length
+	);
+
+int
+gnfp_lookup_open(
+	gnfp_session_t*			session,
+	gnfp_lookup_t**			p_lookup
+	);
+
+/*
+*  Looks up fingerprint data from gnfp_fingerprint(). fp_data doesn't need to
+*  be NUL-terminated, so it can point straight into a mapped file.
+*/
+int
+gnfp_lookup(
+	gnfp_lookup_t*			lookup,
+	const char*				fp_data,
+	size_t					fp_length,
+	gnfp_result_t*			result
+	);
+
+void
+gnfp_lookup_close(
+	gnfp_lookup_t*			lookup
+	);
+
+/*
+*  Appends a message to the session's log if level is enabled. a and b are
+*  recorded with it as numbers. Only valid while a session is open.
+*/
+void
+gnfp_log(
+	int						level,
+	long long				a,
+	long long				b,
+	const char*				text
+	);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _GNFINGERPRINT_H_ */
@@ -0,0 +1,274 @@
+/*
+ *  Name: gnfingerprintmodule
+ *  Description:
+ *  Python 2 bindings for the gnfingerprint library.
+ *
+ *		import gnfingerprint
+ *		session = gnfingerprint.Session(client_id, client_id_tag, license_path)
+ *		session.identify(pcm, 44100, 16, 2)	# -> (artist, album, title) or None
+ *		session.close()
+ *
+ *  identify() accepts any object supporting the buffer protocol (str,
+ *  bytearray, memoryview, array, mmap) without copying it, and releases the
+ *  GIL while it fingerprints and queries, so several threads can identify
+ *  windows in parallel on one session.
+*/
+
+#include <Python.h>
+
+#include "gnfingerprint.h"
+
+typedef struct
+{
+	PyObject_HEAD
+	gnfp_session_t*			session;
+	int						busy;			/* identify() calls in progress; changed with the GIL held */
+} SessionObject;
+
+static PyObject*			s_error			= NULL;
+
+static int
+Session_init(
+	SessionObject*			self,
+	PyObject*				args,
+	PyObject*				kwds
+	)
+{
+	static char*			kwlist[]			= { "client_id", "client_id_tag", "license_path", "client_app_version", NULL };
+	const char*				client_id			= NULL;
+	const char*				client_id_tag		= NULL;
+	const char*				license_path		= NULL;
+	const char*				client_app_version	= "1";
+	gnfp_session_t*			session				= NULL;
+	int						rc					= GNFP_SUCCESS;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "sss|s", kwlist,
+			&client_id, &client_id_tag, &license_path, &client_app_version))
+	{
+		return -1;
+	}
+
+	if (NULL != self->session)
+	{
+		PyErr_SetString(s_error, "session is already open");
+		return -1;
+	}
+
+	/* May register a user with Gracenote or wait for another process to.
+	 * self->session is only set with the GIL held, so a concurrent __init__()
+	 * fails with GNFP_BUSY instead of racing on it. */
+	Py_BEGIN_ALLOW_THREADS
+	rc = gnfp_session_open(client_id, client_id_tag, client_app_version, license_path, &session);
+	Py_END_ALLOW_THREADS
+
+	if (GNFP_BUSY == rc)
+	{
+		PyErr_SetString(s_error, "another session is already open in this process");
+		return -1;
+	}
+	if (GNFP_SUCCESS != rc)
+	{
+		PyErr_SetString(s_error, "GNSDK initialization failed");
+		return -1;
+	}
+	if (NULL != self->session)
+	{
+		/* Another __init__() on this object won while the GIL was released */
+		Py_BEGIN_ALLOW_THREADS
+		gnfp_session_close(session);
+		Py_END_ALLOW_THREADS
+		PyErr_SetString(s_error, "session is already open");
+		return -1;
+	}
+
+	self->session = session;
+	return 0;
+}
+
+static PyObject*
+Session_identify(
+	SessionObject*			self,
+	PyObject*				args,
+	PyObject*				kwds
+	)
+{
+	static char*			kwlist[]		= { "pcm", "sample_rate", "sample_bits", "channels", NULL };
+	PyObject*				data			= NULL;
+	Py_buffer				pcm;
+	unsigned int			sample_rate		= 44100;
+	unsigned int			sample_bits		= 16;
+	unsigned int			channels		= 2;
+	gnfp_result_t			result;
+	int						rc				= GNFP_SUCCESS;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|III", kwlist,
+			&data, &sample_rate, &sample_bits, &channels))
+	{
+		return NULL;
+	}
+
+	/* "s*" would silently encode unicode into a copy; PCM has to be bytes */
+	if (PyUnicode_Check(data))
+	{
+		PyErr_SetString(PyExc_TypeError, "pcm must be a str, bytearray or other buffer, not unicode");
+		return NULL;
+	}
+	if (0 != PyObject_GetBuffer(data, &pcm, PyBUF_SIMPLE))
+	{
+		return NULL;
+	}
+
+	if (NULL == self->session)
+	{
+		PyBuffer_Release(&pcm);
+		PyErr_SetString(s_error, "session is closed");
+		return NULL;
+	}
+
+	self->busy++;
+	Py_BEGIN_ALLOW_THREADS
+	rc = gnfp_identify(self->session, pcm.buf, pcm.len, sample_rate, sample_bits, channels, &result);
+	Py_END_ALLOW_THREADS
+	self->busy--;
+
+	PyBuffer_Release(&pcm);
+
+	if (GNFP_SUCCESS != rc)
+	{
+		PyErr_SetString(s_error, "fingerprint query failed");
+		return NULL;
+	}
+	if (!result.matched)
+	{
+		Py_RETURN_NONE;
+	}
+
+	return Py_BuildValue("(sss)", result.artist, result.album, result.title);
+}
+
+static PyObject*
+Session_close(
+	SessionObject*			self
+	)
+{
+	gnfp_session_t*			session		= self->session;
+
+	if (self->busy > 0)
+	{
+		PyErr_SetString(s_error, "identify() is still running on this session");
+		return NULL;
+	}
+
+	/* Detach the session before releasing the GIL so that no identify() can
+	 * start on it while it shuts down */
+	if (NULL != session)
+	{
+		self->session = NULL;
+		Py_BEGIN_ALLOW_THREADS
+		gnfp_session_close(session);
+		Py_END_ALLOW_THREADS
+	}
+
+	Py_RETURN_NONE;
+}
+
+static void
+Session_dealloc(
+	SessionObject*			self
+	)
+{
+	gnfp_session_t*			session		= self->session;
+
+	/* No identify() can be running, it holds a reference to self. Shutting
+	 * GNSDK down saves the user, so don't hold the GIL for it */
+	if (NULL != session)
+	{
+		self->session = NULL;
+		Py_BEGIN_ALLOW_THREADS
+		gnfp_session_close(session);
+		Py_END_ALLOW_THREADS
+	}
+	Py_TYPE(self)->tp_free((PyObject*)self);
+}
+
+static PyMethodDef Session_methods[] =
+{
+	{ "identify", (PyCFunction)Session_identify, METH_VARARGS | METH_KEYWORDS,
+		"identify(pcm, sample_rate=44100, sample_bits=16, channels=2) -> (artist, album, title) or None\n\n"
+		"Fingerprints interleaved little-endian PCM and looks it up." },
+	{ "close", (PyCFunction)Session_close, METH_NOARGS,
+		"close()\n\nSaves the Gracenote user and shuts GNSDK down." },
+	{ NULL, NULL, 0, NULL }
+};
+
+static PyTypeObject SessionType =
+{
+	PyVarObject_HEAD_INIT(NULL, 0)
+	"gnfingerprint.Session",				/* tp_name */
+	sizeof(SessionObject),					/* tp_basicsize */
+	0,										/* tp_itemsize */
+	(destructor)Session_dealloc,			/* tp_dealloc */
+	0,										/* tp_print */
+	0,										/* tp_getattr */
+	0,										/* tp_setattr */
+	0,										/* tp_compare */
+	0,										/* tp_repr */
+	0,										/* tp_as_number */
+	0,										/* tp_as_sequence */
+	0,										/* tp_as_mapping */
+	0,										/* tp_hash */
+	0,										/* tp_call */
+	0,										/* tp_str */
+	0,										/* tp_getattro */
+	0,										/* tp_setattro */
+	0,										/* tp_as_buffer */
+	Py_TPFLAGS_DEFAULT,						/* tp_flags */
+	"Session(client_id, client_id_tag, license_path, client_app_version='1')\n\n"
+	"An initialized GNSDK and Gracenote user. One can be open per process.",	/* tp_doc */
+	0,										/* tp_traverse */
+	0,										/* tp_clear */
+	0,										/* tp_richcompare */
+	0,										/* tp_weaklistoffset */
+	0,										/* tp_iter */
+	0,										/* tp_iternext */
+	Session_methods,						/* tp_methods */
+	0,										/* tp_members */
+	0,										/* tp_getset */
+	0,										/* tp_base */
+	0,										/* tp_dict */
+	0,										/* tp_descr_get */
+	0,										/* tp_descr_set */
+	0,										/* tp_dictoffset */
+	(initproc)Session_init,					/* tp_init */
+	0,										/* tp_alloc */
+	PyType_GenericNew,						/* tp_new */
+};
+
+static PyMethodDef module_methods[] =
+{
+	{ NULL, NULL, 0, NULL }
+};
+
+PyMODINIT_FUNC
+initgnfingerprint(void)
+{
+	PyObject*	module	= NULL;
+
+	if (PyType_Ready(&SessionType) < 0)
+	{
+		return;
+	}
+
+	module = Py_InitModule3("gnfingerprint", module_methods, "In-process Gracenote MusicID-Stream fingerprinting.");
+	if (NULL == module)
+	{
+		return;
+	}
+
+	s_error = PyErr_NewException("gnfingerprint.error", NULL, NULL);
+	Py_INCREF(s_error);
+	PyModule_AddObject(module, "error", s_error);
+
+	Py_INCREF(&SessionType);
+	PyModule_AddObject(module, "Session", (PyObject*)&SessionType);
+}
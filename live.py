@@ -0,0 +1,143 @@
+"""Live-stream identification.
+
+``gnfingerprint --live`` identifies an endless raw PCM stream and prints a
+"Change:" event, with the stream time, whenever the playing track changes:
+
+    python live.py run episode.wav
+    python live.py replay episode.wav | gnfingerprint --live ... -
+
+``replay`` writes the PCM of a WAV file to stdout at real-time speed, so a
+recorded file can stand in for a live source. ``run`` pipes a replay into
+``gnfingerprint --live`` and prints the track changes as they are reported.
+Windows and cadence follow ``config.LIVE_WINDOW`` and ``config.LIVE_CADENCE``.
+"""
+import argparse
+import logging
+import subprocess
+import sys
+import threading
+import time
+import wave
+
+import config
+import podmapper
+
+
+def replay(wave_path, out, speed=1.0):
+    """Writes the frames of ``wave_path`` to ``out`` in 100 ms blocks, paced
+    to ``speed`` times real time."""
+
+    wave_file = wave.open(wave_path, 'rb')
+    try:
+        block_frames = max(1, wave_file.getframerate() / 10)
+        started = time.time()
+        sent = 0
+        while True:
+            frames = wave_file.readframes(block_frames)
+            if not frames:
+                break
+            out.write(frames)
+            out.flush()
+            sent += block_frames
+
+            # Sleep until the stream time of the data sent so far
+            delay = started + float(sent) / wave_file.getframerate() / speed - time.time()
+            if delay > 0:
+                time.sleep(delay)
+    finally:
+        wave_file.close()
+
+
+def run(wave_path, speed=1.0, window=None, cadence=None):
+    """Replays ``wave_path`` into ``gnfingerprint --live`` and yields
+    (stream time, matched track or None) for every track change."""
+
+    if window is None:
+        window = config.LIVE_WINDOW
+    if cadence is None:
+        cadence = config.LIVE_CADENCE
+
+    wave_file = wave.open(wave_path, 'rb')
+    options = [
+        '--live',
+        '--window', str(window),
+        '--cadence', str(cadence),
+        '--rate', str(wave_file.getframerate()),
+        '--bits', str(wave_file.getsampwidth() * 8),
+        '--channels', str(wave_file.getnchannels()),
+    ]
+    wave_file.close()
+
+    process = subprocess.Popen(['gnfingerprint'] + options + [
+        config.GRACENOTE_CLIENT_ID,
+        config.GRACENOTE_CLIENT_TAG,
+        config.GRACENOTE_LICENCE_PATH,
+        '-',
+    ], stdin=subprocess.PIPE, stdout=subprocess.PIPE)
+
+    # The replay runs in a thread so events can be read while it is paced
+    def _feed():
+        try:
+            replay(wave_path, process.stdin, speed)
+        except IOError:
+            pass
+        finally:
+            process.stdin.close()
+
+    feeder = threading.Thread(target=_feed)
+    feeder.daemon = True
+    feeder.start()
+
+    # Each event's output follows a "Change: <stream time>" line and ends
+    # with the next one
+    change = None
+    lines = []
+    for line in iter(process.stdout.readline, ''):
+        if line.strip().startswith('Change:'):
+            change = float(line.strip()[len('Change:'):])
+            lines = []
+        elif change is not None:
+            lines.append(line)
+            if line.strip().startswith('Title:') or 'No tracks found' in line:
+                yield change, podmapper.parse_fingerprint_output(
+                    '%s at %.3fs' % (wave_path, change), ''.join(lines))
+                change = None
+
+    feeder.join()
+    if process.wait() != 0:
+        raise subprocess.CalledProcessError(process.returncode, 'gnfingerprint')
+
+
+def main(argv):
+    parser = argparse.ArgumentParser(description=__doc__.split('\n')[0])
+    parser.add_argument('--speed', type=float, default=1.0, help='replay speed, 1 is real time')
+    subparsers = parser.add_subparsers(dest='command')
+
+    replay_parser = subparsers.add_parser('replay', help='write a WAV file\'s PCM to stdout in real time')
+    replay_parser.add_argument('wave')
+
+    run_parser = subparsers.add_parser('run', help='identify a replayed WAV file as a live stream')
+    run_parser.add_argument('wave')
+
+    args = parser.parse_args(argv)
+
+    if args.command == 'replay':
+        try:
+            replay(args.wave, sys.stdout, args.speed)
+        except IOError:
+            pass
+    elif args.command == 'run':
+        for offset, track in run(args.wave, args.speed):
+            if track is None:
+                print '%8.1fs  (no track)' % offset
+            else:
+                print '%8.1fs  %s - %s' % (offset, track[0], track[2])
+            sys.stdout.flush()
+
+    return 0
+
+
+if __name__ == '__main__':
+    logging.basicConfig(level=logging.INFO)
+    logging.getLogger('fingerprint').setLevel(logging.WARN)
+    sys.exit(main(sys.argv[1:]))
@@ -8,51 +8,197 @@
 */
 
 /*
- *  Name: musicid_stream
+ *  Name: gnfingerprint
  *  Description:
- *  This example uses MusicID-Stream to fingerprint and identify a music track.
+ *  Command-line front end of the gnfingerprint library: fingerprints and
+ *  identifies the music in WAV files.
  *
  *  Command-line Syntax:
- *  sample client_id client_id_tag license
+ *  gnfingerprint client_id client_id_tag license file [file ...]
+ *  gnfingerprint --export records [--window s] [--hop s] [--min-rms n] client_id client_id_tag license episode [episode ...]
+ *  gnfingerprint --lookup client_id client_id_tag license records [records ...]
+ *  gnfingerprint --live [--window s] [--cadence s] [--rate hz] [--bits n] [--channels n] client_id client_id_tag license pcm
+ *
+ *  With more than one file, each file's output is preceded by a "File:" line.
+ *  --export only fingerprints every window of the episodes and appends the
+ *  fingerprints to a records file, --lookup identifies the windows stored in
+ *  records files; see "Fingerprint records" below. --live identifies an endless
+ *  raw PCM stream ("-" for stdin); see "Live streams" below.
 */
 
-/* GNSDK headers
- *
- * Define the modules your application needs.
- * These constants enable inclusion of headers and symbols in gnsdk.h.
- */
-#define GNSDK_MUSICID               1
-#define GNSDK_STORAGE_SQLITE		1
-#define GNSDK_DSP					1
-#include "gnsdk.h"
+#include "gnfingerprint.h"
 
-/* Standard C headers - used by the sample app, but not required for GNSDK */
+/* Standard C headers */
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 
+/* POSIX headers - used by the prefetching reader and the records files */
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ * Prefetching reader
+ *
+ * In a batch run the input files are read ahead of the fingerprinter, so the
+ * DSP doesn't wait on cold-cache reads. A fixed pool of GNFP_PREFETCH_DEPTH
+ * slots (default 4) holds the next files; slot buffers are reused and only
+ * grow. Reads are issued through io_uring when built with
+ * GNFP_HAVE_LIBURING (link with -luring) and the kernel supports it, else by
+ * GNFP_PREFETCH_THREADS reader threads (default 2). GNFP_PREFETCH_DEPTH=0
+ * reads each file synchronously when it is needed, as before.
+ *
+ * The time spent waiting for input is logged at the info level.
+ */
+#define GNFP_WAVE_HEADER_SIZE	44		/* We know the format of our sample files */
+
+#define _PREFETCH_FREE			0
+#define _PREFETCH_QUEUED		1
+#define _PREFETCH_LOADING		2
+#define _PREFETCH_READY			3
+
+typedef struct
+{
+	long					index;			/* File this slot holds, -1 when free */
+	int						state;
+	int						error;			/* errno of a failed read, or 0 */
+	char*					buffer;
+	size_t					capacity;
+	size_t					length;
+	int						fd;				/* Open while an io_uring read is in flight */
+	size_t					size;			/* Expected file size */
+} _prefetch_slot_t;
+
+/*
+ * Fingerprint records
+ *
+ * --export writes one record per window to an append-only file that --lookup
+ * maps into memory. The file starts with the 8 byte magic "GNFPREC2",
+ * followed by records of:
+ *
+ *   _record_header_t	native byte order
+ *   episode			episode_length bytes, not NUL-terminated
+ *   fingerprint		fp_length bytes of GNFPX data, not NUL-terminated
+ *   padding			zeros up to size, a multiple of 8
+ *
+ * Records start at multiples of 8. Each one is appended with a single write()
+ * while holding an fcntl() lock on the file, so several exports, also on
+ * different hosts sharing the file over NFS, can append to it. A failed
+ * write is truncated away. A record cut short by a crash is skipped by
+ * readers, which resync at the next header whose checksum matches; writers
+ * pad the file back to alignment before appending after one.
+ *
+ * Export windows are fingerprinted by GNFP_EXPORT_THREADS threads (default:
+ * one per CPU). Lookups run in batches of GNFP_LOOKUP_BATCH records (default
+ * 1000) spread over GNFP_LOOKUP_THREADS threads (default 4), each reusing one
+ * query handle; results are printed in file order.
+ */
+#define GNFP_RECORDS_MAGIC		"GNFPREC2"
+#define GNFP_RECORDS_ALIGN		8
+
+typedef struct
+{
+	uint32_t				size;			/* Whole record, including this header and padding */
+	uint32_t				offset_ms;		/* Window start in the episode */
+	uint32_t				duration_ms;
+	uint32_t				fp_length;
+	uint32_t				episode_length;
+	uint32_t				checksum;		/* FNV-1a of the whole record with this field 0 */
+} _record_header_t;
+
+/*
+ * Live streams
+ *
+ * --live keeps the last --window seconds (default 8) of a raw PCM stream in
+ * a ring buffer. Every --cadence seconds (default 4) of stream time that
+ * window is copied to a free query slot and identified by one of
+ * GNFP_LIVE_THREADS workers (default 2); there is one slot per worker, so
+ * memory use is fixed. When every slot is still busy the window is dropped
+ * and counted: the queries have fallen behind real time.
+ *
+ * Results are handled in stream order. When the identified track changes a
+ * "Change:" line with the stream time of the window's start is printed,
+ * followed by the track as in the batch output, or by "No tracks found"
+ * once GNFP_LIVE_MISSES windows in a row matched nothing. A track is
+ * therefore reported at most window + cadence seconds, plus the query time,
+ * after it starts.
+ */
+#define GNFP_LIVE_MISSES		2
+
+#define _LIVE_FREE				0
+#define _LIVE_QUEUED			1
+#define _LIVE_QUERYING			2
+#define _LIVE_DONE				3
+
+typedef struct
+{
+	long long				sequence;		/* Queued windows are numbered in stream order */
+	int						state;
+	char*					pcm;
+	double					start;			/* Stream time of the window's start, in seconds */
+	double					received;		/* When the window's last byte was read */
+	int						rc;
+	gnfp_result_t			result;
+} _live_slot_t;
+
 /*
  * Local function declarations
  */
 static int
-_init_gnsdk(
-	const char*				client_id,
-	const char*				client_id_tag,
-	const char*				client_app_version,
-	const char*				license_path,
-	gnsdk_user_handle_t*	p_user_handle
+_export_episodes(
+	gnfp_session_t*			session,
+	const char*				records_path,
+	char**					paths,
+	long					count,
+	double					window,
+	double					hop,
+	long					min_rms
+	);
+
+static int
+_lookup_records(
+	gnfp_session_t*			session,
+	char**					paths,
+	long					count
+	);
+
+static int
+_live_stream(
+	gnfp_session_t*			session,
+	const char*				path,
+	double					window,
+	double					cadence,
+	unsigned int			sample_rate,
+	unsigned int			sample_bits,
+	unsigned int			channels
 	);
 
 static void
-_shutdown_gnsdk(
-	gnsdk_user_handle_t		user_handle,
-	const char*				client_id
+_identify_file(
+	gnfp_session_t*			session,
+	long					file_index
+	);
+
+static int
+_prefetch_start(
+	char**					paths,
+	long					count
 	);
 
 static void
-_do_sample_musicid_stream(
-	gnsdk_user_handle_t		user_handle,
-	char*					file
+_prefetch_stop(void);
+
+static unsigned int
+_parse_count(
+	const char*				text,
+	unsigned long			max
 	);
 
 /*
@@ -61,841 +207,1955 @@ _do_sample_musicid_stream(
 int
 main(int argc, char* argv[])
 {
-	gnsdk_user_handle_t		user_handle			= GNSDK_NULL;
+	gnfp_session_t*			session				= NULL;
 	const char*				client_id			= NULL;
 	const char*				client_id_tag		= NULL;
 	const char*				client_app_version	= "1";
 	const char*				license_path		= NULL;
-	const char*				file_path   		= NULL;
+	const char*				export_path			= NULL;
+	int						lookup				= 0;
+	int						live				= 0;
+	double					window				= 0;
+	double					hop					= 10;
+	double					cadence				= 4;
+	long					min_rms				= 0;
+	unsigned int			sample_rate			= 44100;
+	unsigned int			sample_bits			= 16;
+	unsigned int			channels			= 2;
+	int						arg					= 1;
+	long					file_count			= 0;
+	long					file_index			= 0;
 	int						rc					= 0;
 
+	/* Options come first */
+	for (; arg < argc && 0 == strncmp(argv[arg], "--", 2); arg++)
+	{
+		if (0 == strcmp(argv[arg], "--lookup"))
+		{
+			lookup = 1;
+		}
+		else if (0 == strcmp(argv[arg], "--live"))
+		{
+			live = 1;
+		}
+		else if (arg + 1 < argc && 0 == strcmp(argv[arg], "--cadence"))
+		{
+			cadence = atof(argv[++arg]);
+		}
+		else if (arg + 1 < argc && 0 == strcmp(argv[arg], "--rate"))
+		{
+			sample_rate = _parse_count(argv[++arg], 1000000);
+		}
+		else if (arg + 1 < argc && 0 == strcmp(argv[arg], "--bits"))
+		{
+			sample_bits = _parse_count(argv[++arg], 32);
+		}
+		else if (arg + 1 < argc && 0 == strcmp(argv[arg], "--channels"))
+		{
+			channels = _parse_count(argv[++arg], 64);
+		}
+		else if (arg + 1 < argc && 0 == strcmp(argv[arg], "--export"))
+		{
+			export_path = argv[++arg];
+		}
+		else if (arg + 1 < argc && 0 == strcmp(argv[arg], "--window"))
+		{
+			window = atof(argv[++arg]);
+		}
+		else if (arg + 1 < argc && 0 == strcmp(argv[arg], "--hop"))
+		{
+			hop = atof(argv[++arg]);
+		}
+		else if (arg + 1 < argc && 0 == strcmp(argv[arg], "--min-rms"))
+		{
+			min_rms = atol(argv[++arg]);
+		}
+		else
+		{
+			break;
+		}
+	}
+
+	if (0 == window)
+	{
+		window = live ? 8 : 10;
+	}
+
 	/* Client ID, Client ID Tag and License file must be passed in */
 
-	if (argc == 5)
+	if (argc - arg >= 4 && 0 != strncmp(argv[arg], "--", 2)
+		&& lookup + live + (NULL != export_path) <= 1 && (!live || argc - arg == 4)
+		&& window > 0 && hop > 0 && cadence > 0 && sample_rate > 0
+		&& 0 == sample_bits % 8 && sample_bits >= 8 && sample_bits <= 32 && channels > 0)
 	{
-		client_id = argv[1];
-		client_id_tag = argv[2];
-		license_path = argv[3];
-		file_path = argv[4];
+		client_id = argv[arg];
+		client_id_tag = argv[arg + 1];
+		license_path = argv[arg + 2];
+		file_count = argc - arg - 3;
 
 		/* GNSDK initialization */
-		rc = _init_gnsdk(
+		rc = gnfp_session_open(
 				client_id,
 				client_id_tag,
 				client_app_version,
 				license_path,
-				&user_handle
+				&session
 				);
-		if (0 == rc)
+		if (GNFP_SUCCESS == rc)
 		{
-			/* Perform a sample track TOC query */
-			_do_sample_musicid_stream(user_handle, file_path);
+			if (NULL != export_path)
+			{
+				rc = _export_episodes(session, export_path, &argv[arg + 3], file_count, window, hop, min_rms);
+			}
+			else if (lookup)
+			{
+				rc = _lookup_records(session, &argv[arg + 3], file_count);
+			}
+			else if (live)
+			{
+				rc = _live_stream(session, argv[arg + 3], window, cadence, sample_rate, sample_bits, channels);
+			}
+			else
+			{
+				/* Start reading ahead, then query each file in turn */
+				rc = _prefetch_start(&argv[arg + 3], file_count);
+
+				for (file_index = 0; 0 == rc && file_index < file_count; file_index++)
+				{
+					if (file_count > 1)
+					{
+						/* Flush first: errors go to stderr, which may share a pipe with stdout */
+						printf("%16s %s\n", "File:", argv[arg + 3 + file_index]);
+						fflush(stdout);
+					}
+					_identify_file(session, file_index);
+					fflush(stdout);
+				}
+
+				_prefetch_stop();
+			}
 
 			/* Clean up and shutdown */
-			_shutdown_gnsdk(user_handle, client_id);
+			gnfp_session_close(session);
 		}
 	}
 	else
 	{
-		printf("\nUsage:\n%s clientid clientidtag license file\n", argv[0]);
+		printf("\nUsage:\n%s clientid clientidtag license file [file ...]\n", argv[0]);
+		printf("%s --export records [--window s] [--hop s] [--min-rms n] clientid clientidtag license episode [episode ...]\n", argv[0]);
+		printf("%s --lookup clientid clientidtag license records [records ...]\n", argv[0]);
+		printf("%s --live [--window s] [--cadence s] [--rate hz] [--bits n] [--channels n] clientid clientidtag license pcm\n", argv[0]);
 		rc = -1;
 	}
 
 	return rc;
 }
 
+/* A whole number in 1..max, or 0 for anything else so that the option check rejects it */
+static unsigned int
+_parse_count(
+	const char*				text,
+	unsigned long			max
+	)
+{
+	char*					end			= NULL;
+	long					value		= 0;
+
+	errno = 0;
+	value = strtol(text, &end, 10);
+	if (0 != errno || end == text || '\0' != *end || value < 1 || (unsigned long)value > max)
+	{
+		return 0;
+	}
+
+	return (unsigned int)value;
+}
 
 /*
-* Echo the error and information.
+*  Prefetching reader, see the description at the top of the file.
 */
+static struct
+{
+	char**					paths;
+	long					count;
+	long					next;			/* Next file to hand to a free slot */
+	_prefetch_slot_t*		slots;
+	int						depth;
+
+	pthread_mutex_t			mutex;
+	pthread_cond_t			cond;
+	pthread_t*				threads;
+	int						num_threads;
+	int						stop;
+
+	double					wait_seconds;	/* Time the fingerprinter spent waiting for input */
+	unsigned long long		bytes;
+	int						uring;
+} s_prefetch;
+
+static double
+_now_seconds(void)
+{
+	struct timespec	ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Opens the slot's file and sizes its buffer; the caller reads into it */
+static int
+_prefetch_open(
+	_prefetch_slot_t*	slot
+	)
+{
+	struct stat	file_stat;
+	char*		buffer		= NULL;
+
+	slot->length = 0;
+	slot->fd = open(s_prefetch.paths[slot->index], O_RDONLY);
+	if (-1 == slot->fd)
+	{
+		return errno;
+	}
+
+	if (0 != fstat(slot->fd, &file_stat) || file_stat.st_size < GNFP_WAVE_HEADER_SIZE)
+	{
+		close(slot->fd);
+		slot->fd = -1;
+		return EINVAL;
+	}
+
+	slot->size = file_stat.st_size - GNFP_WAVE_HEADER_SIZE;
+	if (slot->size > slot->capacity)
+	{
+		buffer = realloc(slot->buffer, slot->size);
+		if (NULL == buffer)
+		{
+			close(slot->fd);
+			slot->fd = -1;
+			return ENOMEM;
+		}
+		slot->buffer = buffer;
+		slot->capacity = slot->size;
+	}
+	slot->length = 0;
+
+	return 0;
+}
+
+/* Reads the slot's file synchronously */
+static int
+_prefetch_load(
+	_prefetch_slot_t*	slot
+	)
+{
+	ssize_t	read_len	= 0;
+	int		error		= 0;
+
+	error = _prefetch_open(slot);
+	if (0 != error)
+	{
+		return error;
+	}
+
+	while (slot->length < slot->size)
+	{
+		read_len = pread(slot->fd, slot->buffer + slot->length, slot->size - slot->length, GNFP_WAVE_HEADER_SIZE + slot->length);
+		if (read_len < 0 && EINTR == errno)
+		{
+			continue;
+		}
+		if (read_len <= 0)
+		{
+			error = (read_len < 0) ? errno : 0;
+			break;
+		}
+		slot->length += read_len;
+	}
+
+	close(slot->fd);
+	slot->fd = -1;
+	return error;
+}
+
+/* Hands files to free slots; called with the mutex held */
+static void
+_prefetch_fill(void)
+{
+	_prefetch_slot_t*	slot	= NULL;
+
+	while (s_prefetch.next < s_prefetch.count)
+	{
+		slot = &s_prefetch.slots[s_prefetch.next % s_prefetch.depth];
+		if (_PREFETCH_FREE != slot->state)
+		{
+			break;
+		}
+		slot->index = s_prefetch.next++;
+		slot->state = _PREFETCH_QUEUED;
+		slot->error = 0;
+	}
+	pthread_cond_broadcast(&s_prefetch.cond);
+}
+
+/* Thread pool backend: each thread loads queued slots one at a time */
+static void*
+_prefetch_thread(void* arg)
+{
+	_prefetch_slot_t*	slot	= NULL;
+	int					error	= 0;
+	int					i		= 0;
+
+	(void)arg;
+	pthread_mutex_lock(&s_prefetch.mutex);
+	for (;;)
+	{
+		slot = NULL;
+		for (i = 0; i < s_prefetch.depth && NULL == slot; i++)
+		{
+			if (_PREFETCH_QUEUED == s_prefetch.slots[i].state)
+			{
+				slot = &s_prefetch.slots[i];
+			}
+		}
+		if (NULL == slot)
+		{
+			if (s_prefetch.stop)
+			{
+				break;
+			}
+			pthread_cond_wait(&s_prefetch.cond, &s_prefetch.mutex);
+			continue;
+		}
+
+		slot->state = _PREFETCH_LOADING;
+		pthread_mutex_unlock(&s_prefetch.mutex);
+
+		error = _prefetch_load(slot);
+
+		pthread_mutex_lock(&s_prefetch.mutex);
+		slot->error = error;
+		slot->state = _PREFETCH_READY;
+		pthread_cond_broadcast(&s_prefetch.cond);
+	}
+	pthread_mutex_unlock(&s_prefetch.mutex);
+
+	return NULL;
+}
+
+#ifdef GNFP_HAVE_LIBURING
+#include <liburing.h>
+
+static struct io_uring	s_prefetch_ring;
+
 static void
-_display_error(
-	int				line_num,
-	const char*		info,
-	gnsdk_error_t	error_code
+_prefetch_uring_submit(
+	_prefetch_slot_t*	slot
+	)
+{
+	struct io_uring_sqe*	sqe	= io_uring_get_sqe(&s_prefetch_ring);
+
+	io_uring_prep_read(sqe, slot->fd, slot->buffer + slot->length, slot->size - slot->length, GNFP_WAVE_HEADER_SIZE + slot->length);
+	io_uring_sqe_set_data(sqe, slot);
+}
+
+/* io_uring backend: one thread keeps a read in flight for every queued slot */
+static void*
+_prefetch_uring_thread(void* arg)
+{
+	struct io_uring_cqe*		cqe			= NULL;
+	struct __kernel_timespec	timeout		= { 0, 2 * 1000 * 1000 };	/* 2ms */
+	_prefetch_slot_t*			slot		= NULL;
+	int							in_flight	= 0;
+	int							error		= 0;
+	int							i			= 0;
+
+	(void)arg;
+	for (;;)
+	{
+		/* Start reads for newly queued slots; sleep if there is nothing to do */
+		pthread_mutex_lock(&s_prefetch.mutex);
+		while (0 == in_flight && !s_prefetch.stop)
+		{
+			for (i = 0; i < s_prefetch.depth; i++)
+			{
+				if (_PREFETCH_QUEUED == s_prefetch.slots[i].state)
+				{
+					break;
+				}
+			}
+			if (i < s_prefetch.depth)
+			{
+				break;
+			}
+			pthread_cond_wait(&s_prefetch.cond, &s_prefetch.mutex);
+		}
+		if (0 == in_flight && s_prefetch.stop)
+		{
+			pthread_mutex_unlock(&s_prefetch.mutex);
+			break;
+		}
+		for (i = 0; i < s_prefetch.depth; i++)
+		{
+			slot = &s_prefetch.slots[i];
+			if (_PREFETCH_QUEUED != slot->state)
+			{
+				continue;
+			}
+			slot->state = _PREFETCH_LOADING;
+			error = _prefetch_open(slot);
+			if (0 == error && slot->size > 0)
+			{
+				_prefetch_uring_submit(slot);
+				in_flight++;
+			}
+			else
+			{
+				if (-1 != slot->fd)
+				{
+					close(slot->fd);
+					slot->fd = -1;
+				}
+				slot->error = error;
+				slot->state = _PREFETCH_READY;
+				pthread_cond_broadcast(&s_prefetch.cond);
+			}
+		}
+		pthread_mutex_unlock(&s_prefetch.mutex);
+
+		io_uring_submit(&s_prefetch_ring);
+
+		/* Reap completions; short reads are resubmitted for the rest */
+		if (0 != io_uring_wait_cqe_timeout(&s_prefetch_ring, &cqe, &timeout))
+		{
+			continue;
+		}
+		do
+		{
+			slot = io_uring_cqe_get_data(cqe);
+			if (cqe->res > 0)
+			{
+				slot->length += cqe->res;
+			}
+			io_uring_cqe_seen(&s_prefetch_ring, cqe);
+
+			if (cqe->res > 0 && slot->length < slot->size)
+			{
+				_prefetch_uring_submit(slot);
+				io_uring_submit(&s_prefetch_ring);
+				continue;
+			}
+
+			close(slot->fd);
+			slot->fd = -1;
+			in_flight--;
+
+			pthread_mutex_lock(&s_prefetch.mutex);
+			slot->error = (cqe->res < 0) ? -cqe->res : 0;
+			slot->state = _PREFETCH_READY;
+			pthread_cond_broadcast(&s_prefetch.cond);
+			pthread_mutex_unlock(&s_prefetch.mutex);
+		} while (0 == io_uring_peek_cqe(&s_prefetch_ring, &cqe));
+	}
+
+	return NULL;
+}
+#endif /* GNFP_HAVE_LIBURING */
+
+static int
+_prefetch_start(
+	char**		paths,
+	long		count
 	)
 {
-	const	gnsdk_error_info_t*	error_info = gnsdk_manager_error_info();
-
-	/* Error_info will never be GNSDK_NULL.
-	 * The SDK will always return a pointer to a populated error info structure.
-	 */
-	fprintf(stderr,
-		"\nerror 0x%08x - %s\n\tline %d, info %s\n",
-		error_code,
-		error_info->error_description,
-		line_num,
-		info
+	const char*	value		= NULL;
+	int			started		= 0;
+	int			i			= 0;
+
+	s_prefetch.paths = paths;
+	s_prefetch.count = count;
+	s_prefetch.depth = 4;
+	s_prefetch.num_threads = 2;
+
+	value = getenv("GNFP_PREFETCH_DEPTH");
+	if (NULL != value && atoi(value) >= 0)
+	{
+		s_prefetch.depth = atoi(value);
+	}
+	value = getenv("GNFP_PREFETCH_THREADS");
+	if (NULL != value && atoi(value) > 0)
+	{
+		s_prefetch.num_threads = atoi(value);
+	}
+
+	/* No point reading further ahead than there are files after this one */
+	if (s_prefetch.depth > count - 1)
+	{
+		s_prefetch.depth = (count > 1) ? count - 1 : 0;
+	}
+
+	/* Synchronous mode still uses one slot, loaded on demand */
+	s_prefetch.slots = calloc((s_prefetch.depth > 0) ? s_prefetch.depth : 1, sizeof(_prefetch_slot_t));
+	if (NULL == s_prefetch.slots)
+	{
+		printf("Error allocating memory.\n");
+		s_prefetch.depth = 0;
+		return -1;
+	}
+	for (i = 0; i < ((s_prefetch.depth > 0) ? s_prefetch.depth : 1); i++)
+	{
+		s_prefetch.slots[i].index = -1;
+		s_prefetch.slots[i].fd = -1;
+	}
+
+	if (0 == s_prefetch.depth)
+	{
+		return 0;
+	}
+
+	pthread_mutex_init(&s_prefetch.mutex, NULL);
+	pthread_cond_init(&s_prefetch.cond, NULL);
+	s_prefetch.threads = calloc(s_prefetch.num_threads, sizeof(pthread_t));
+
+#ifdef GNFP_HAVE_LIBURING
+	if (NULL != s_prefetch.threads && 0 == io_uring_queue_init(s_prefetch.depth * 2, &s_prefetch_ring, 0))
+	{
+		if (0 == pthread_create(&s_prefetch.threads[0], NULL, _prefetch_uring_thread, NULL))
+		{
+			s_prefetch.uring = 1;
+			started = 1;
+		}
+		else
+		{
+			io_uring_queue_exit(&s_prefetch_ring);
+		}
+	}
+#endif
+
+	for (i = 0; !s_prefetch.uring && NULL != s_prefetch.threads && i < s_prefetch.num_threads; i++)
+	{
+		if (0 == pthread_create(&s_prefetch.threads[i], NULL, _prefetch_thread, NULL))
+		{
+			started++;
+		}
+	}
+	s_prefetch.num_threads = started;
+
+	if (0 == started)
+	{
+		/* Couldn't start any reader, fall back to reading synchronously */
+		free(s_prefetch.threads);
+		s_prefetch.threads = NULL;
+		pthread_cond_destroy(&s_prefetch.cond);
+		pthread_mutex_destroy(&s_prefetch.mutex);
+		s_prefetch.depth = 0;
+		return 0;
+	}
+
+	pthread_mutex_lock(&s_prefetch.mutex);
+	_prefetch_fill();
+	pthread_mutex_unlock(&s_prefetch.mutex);
+
+	return 0;
+}
+
+/* Returns the slot holding file index once it has been read */
+static _prefetch_slot_t*
+_prefetch_get(
+	long	index
+	)
+{
+	_prefetch_slot_t*	slot		= NULL;
+	double				started		= _now_seconds();
+
+	if (0 == s_prefetch.depth)
+	{
+		slot = &s_prefetch.slots[0];
+		slot->index = index;
+		slot->error = _prefetch_load(slot);
+	}
+	else
+	{
+		slot = &s_prefetch.slots[index % s_prefetch.depth];
+		pthread_mutex_lock(&s_prefetch.mutex);
+		while (slot->index != index || _PREFETCH_READY != slot->state)
+		{
+			pthread_cond_wait(&s_prefetch.cond, &s_prefetch.mutex);
+		}
+		pthread_mutex_unlock(&s_prefetch.mutex);
+	}
+
+	s_prefetch.wait_seconds += _now_seconds() - started;
+	s_prefetch.bytes += slot->length;
+
+	return slot;
+}
+
+/* Recycles a slot for the next file */
+static void
+_prefetch_put(
+	_prefetch_slot_t*	slot
+	)
+{
+	if (0 == s_prefetch.depth)
+	{
+		return;
+	}
+
+	pthread_mutex_lock(&s_prefetch.mutex);
+	slot->state = _PREFETCH_FREE;
+	slot->index = -1;
+	_prefetch_fill();
+	pthread_mutex_unlock(&s_prefetch.mutex);
+}
+
+static void
+_prefetch_stop(void)
+{
+	char	report[128];
+	int		i			= 0;
+
+	if (s_prefetch.depth > 0)
+	{
+		pthread_mutex_lock(&s_prefetch.mutex);
+		s_prefetch.stop = 1;
+		pthread_cond_broadcast(&s_prefetch.cond);
+		pthread_mutex_unlock(&s_prefetch.mutex);
+
+		for (i = 0; i < s_prefetch.num_threads; i++)
+		{
+			pthread_join(s_prefetch.threads[i], NULL);
+		}
+		free(s_prefetch.threads);
+#ifdef GNFP_HAVE_LIBURING
+		if (s_prefetch.uring)
+		{
+			io_uring_queue_exit(&s_prefetch_ring);
+		}
+#endif
+		pthread_cond_destroy(&s_prefetch.cond);
+		pthread_mutex_destroy(&s_prefetch.mutex);
+	}
+
+	snprintf(report, sizeof(report), "input: files=%ld bytes=%llu io_wait_ms=%.1f depth=%d backend=%s",
+		s_prefetch.count,
+		s_prefetch.bytes,
+		s_prefetch.wait_seconds * 1000,
+		s_prefetch.depth,
+		(0 == s_prefetch.depth) ? "sync" : (s_prefetch.uring ? "io_uring" : "threads")
 		);
+	gnfp_log(GNFP_LOG_INFO, (long long)(s_prefetch.wait_seconds * 1e6), s_prefetch.bytes, report);
+
+	for (i = 0; i < ((s_prefetch.depth > 0) ? s_prefetch.depth : 1) && NULL != s_prefetch.slots; i++)
+	{
+		free(s_prefetch.slots[i].buffer);
+	}
+	free(s_prefetch.slots);
+	s_prefetch.slots = NULL;
+}
+
+/*
+ * Identifies one input file and prints the result
+ */
+static void
+_identify_file(
+	gnfp_session_t*			session,
+	long					file_index
+	)
+{
+	_prefetch_slot_t*		input		= NULL;
+	gnfp_result_t			result;
+	int						rc			= GNFP_SUCCESS;
+
+	input = _prefetch_get(file_index);
+	if (0 != input->error)
+	{
+		printf("\n\n!!!!Failed to open input file: %s!!!\n\n", s_prefetch.paths[file_index]);
+		_prefetch_put(input);
+		return;
+	}
+
+	/* Note: our sample files are 44100Hz 16-bit stereo (2 channel) wav files */
+	rc = gnfp_identify(session, input->buffer, input->length, 44100, 16, 2, &result);
+	_prefetch_put(input);
+
+	if (GNFP_SUCCESS != rc)
+	{
+		return;
+	}
+
+	if (!result.matched)
+	{
+		printf("\nNo tracks found for the input.\n");
+	}
+	else
+	{
+		printf( "%16s\n", "Final track:");
+		printf( "%16s %s\n", "Artist:", result.artist );
+		printf( "%16s %s\n", "Album:", result.album );
+		printf( "%16s %s\n", "Title:", result.title );
+	}
 }
 
 /*
-*    Load existing user handle, or register new one.
-*
-*    GNSDK requires a user handle instance to perform queries.
-*    User handles encapsulate your Gracenote provided Client ID which is unique for your
-*    application. User handles are registered once with Gracenote then must be saved by
-*    your application and reused on future invocations.
+*  Fingerprint records, see the description at the top of the file.
 */
+static struct
+{
+	gnfp_session_t*			session;
+	int						fd;
+	const char*				episode;
+	size_t					episode_length;
+
+	const char*				pcm;
+	size_t					frames;
+	unsigned int			sample_rate;
+	unsigned int			sample_bits;
+	unsigned int			channels;
+	unsigned int			block_align;
+
+	double					window;
+	double					hop;
+	long					min_rms;
+	long					num_windows;
+	long					next;			/* Next window to fingerprint, claimed atomically */
+
+	pthread_mutex_t			write_mutex;	/* fcntl() locks don't exclude threads of one process */
+
+	unsigned long			written;
+	unsigned long			quiet;
+	unsigned long			errors;
+	unsigned long long		bytes;
+} s_export;
+
+static uint32_t
+_record_checksum(
+	const char*		record,
+	size_t			size
+	)
+{
+	uint32_t		hash	= 2166136261u;
+	size_t			i		= 0;
+
+	for (i = 0; i < size; i++)
+	{
+		/* The checksum field itself counts as zeros */
+		if (i < offsetof(_record_header_t, checksum) || i >= offsetof(_record_header_t, checksum) + sizeof(uint32_t))
+		{
+			hash ^= (unsigned char)record[i];
+		}
+		hash *= 16777619u;
+	}
+
+	return hash;
+}
+
+/* Maps a WAV file and finds its format and PCM data */
+static int
+_wave_map(
+	const char*		path,
+	char**			p_map,
+	size_t*			p_map_size
+	)
+{
+	struct stat		file_stat;
+	const char*		chunk		= NULL;
+	const char*		end			= NULL;
+	uint32_t		chunk_size	= 0;
+	uint16_t		value16		= 0;
+	char*			map			= NULL;
+	int				fd			= -1;
+
+	fd = open(path, O_RDONLY);
+	if (-1 == fd)
+	{
+		return -1;
+	}
+	if (0 != fstat(fd, &file_stat) || file_stat.st_size < 12)
+	{
+		close(fd);
+		return -1;
+	}
+	map = mmap(NULL, file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (MAP_FAILED == map)
+	{
+		return -1;
+	}
+
+	*p_map = map;
+	*p_map_size = file_stat.st_size;
+	s_export.pcm = NULL;
+	s_export.block_align = 0;
+
+	if (0 != memcmp(map, "RIFF", 4) || 0 != memcmp(map + 8, "WAVE", 4))
+	{
+		return -1;
+	}
+
+	end = map + file_stat.st_size;
+	for (chunk = map + 12; chunk + 8 <= end; chunk += 8 + chunk_size + (chunk_size & 1))
+	{
+		memcpy(&chunk_size, chunk + 4, 4);
+		if (0 == memcmp(chunk, "fmt ", 4) && chunk_size >= 16 && chunk + 24 <= end)
+		{
+			memcpy(&value16, chunk + 10, 2);
+			s_export.channels = value16;
+			memcpy(&s_export.sample_rate, chunk + 12, 4);
+			memcpy(&value16, chunk + 20, 2);
+			s_export.block_align = value16;
+			memcpy(&value16, chunk + 22, 2);
+			s_export.sample_bits = value16;
+		}
+		else if (0 == memcmp(chunk, "data", 4))
+		{
+			/* A streamed WAV may not know its length, the data runs to the end */
+			s_export.pcm = chunk + 8;
+			if (chunk_size > (size_t)(end - s_export.pcm))
+			{
+				chunk_size = end - s_export.pcm;
+			}
+			s_export.frames = (0 != s_export.block_align) ? chunk_size / s_export.block_align : 0;
+			break;
+		}
+	}
+
+	if (NULL == s_export.pcm || 0 == s_export.block_align || 0 == s_export.sample_rate)
+	{
+		return -1;
+	}
+
+	return 0;
+}
+
+/* Mean square of 16-bit samples; other sample widths are never treated as quiet */
 static int
-_get_user_handle(
-	const char*				client_id,
-	const char*				client_id_tag,
-	const char*				client_app_version,
-	gnsdk_user_handle_t*	p_user_handle
+_is_quiet(
+	const char*		pcm,
+	size_t			length
 	)
 {
-	gnsdk_error_t		error				= GNSDK_SUCCESS;
-	gnsdk_user_handle_t	user_handle			= GNSDK_NULL;
-	char*				user_filename		= NULL;
-	size_t				user_filename_len	= 0;
-	int					rc					= 0;
-	FILE*				file				= NULL;
+	const int16_t*	samples	= (const int16_t*)pcm;
+	size_t			count	= length / 2;
+	double			sum		= 0;
+	size_t			i		= 0;
+
+	if (0 == s_export.min_rms || 16 != s_export.sample_bits || 0 == count)
+	{
+		return 0;
+	}
 
-	user_filename_len = strlen(client_id)+strlen("_user.txt")+1;
-	user_filename = malloc(user_filename_len);
+	for (i = 0; i < count; i++)
+	{
+		sum += (double)samples[i] * samples[i];
+	}
 
-	if (NULL != user_filename)
+	return sum / count < (double)s_export.min_rms * s_export.min_rms;
+}
+
+static int
+_write_record(
+	char**			p_buffer,
+	size_t*			p_capacity,
+	uint32_t		offset_ms,
+	uint32_t		duration_ms,
+	const char*		fp_data,
+	size_t			fp_length
+	)
+{
+	_record_header_t	header;
+	struct flock		lock;
+	struct stat			file_stat;
+	char*				buffer		= NULL;
+	char*				record		= NULL;
+	size_t				size		= 0;
+	size_t				pad			= 0;
+	ssize_t				written		= 0;
+	int					error		= 0;
+
+	/* Room in front of the record for padding the file back to alignment */
+	size = sizeof(header) + s_export.episode_length + fp_length;
+	size = (size + GNFP_RECORDS_ALIGN - 1) & ~(size_t)(GNFP_RECORDS_ALIGN - 1);
+	if (GNFP_RECORDS_ALIGN + size > *p_capacity)
+	{
+		buffer = realloc(*p_buffer, GNFP_RECORDS_ALIGN + size);
+		if (NULL == buffer)
+		{
+			return -1;
+		}
+		*p_buffer = buffer;
+		*p_capacity = GNFP_RECORDS_ALIGN + size;
+	}
+	record = *p_buffer + GNFP_RECORDS_ALIGN;
+
+	memset(&header, 0, sizeof(header));
+	header.size = size;
+	header.offset_ms = offset_ms;
+	header.duration_ms = duration_ms;
+	header.fp_length = fp_length;
+	header.episode_length = s_export.episode_length;
+
+	memset(*p_buffer, 0, GNFP_RECORDS_ALIGN + size);
+	memcpy(record, &header, sizeof(header));
+	memcpy(record + sizeof(header), s_export.episode, s_export.episode_length);
+	memcpy(record + sizeof(header) + s_export.episode_length, fp_data, fp_length);
+	header.checksum = _record_checksum(record, size);
+	memcpy(record, &header, sizeof(header));
+
+	memset(&lock, 0, sizeof(lock));
+	lock.l_type = F_WRLCK;
+	lock.l_whence = SEEK_SET;
+
+	pthread_mutex_lock(&s_export.write_mutex);
+	if (-1 == fcntl(s_export.fd, F_SETLKW, &lock) || -1 == fstat(s_export.fd, &file_stat))
+	{
+		error = errno;
+	}
+	else
+	{
+		/* One write per record; on failure cut the file back so it doesn't end in a torn record */
+		pad = (GNFP_RECORDS_ALIGN - file_stat.st_size % GNFP_RECORDS_ALIGN) % GNFP_RECORDS_ALIGN;
+		written = write(s_export.fd, record - pad, pad + size);
+		if (written != (ssize_t)(pad + size))
+		{
+			error = (written < 0) ? errno : ENOSPC;
+			if (written > 0 && 0 != ftruncate(s_export.fd, file_stat.st_size))
+			{
+				fprintf(stderr, "Error truncating a torn fingerprint record: %s\n", strerror(errno));
+			}
+		}
+
+		lock.l_type = F_UNLCK;
+		fcntl(s_export.fd, F_SETLK, &lock);
+	}
+	pthread_mutex_unlock(&s_export.write_mutex);
+
+	if (0 != error)
+	{
+		errno = error;
+		return -1;
+	}
+
+	__atomic_fetch_add(&s_export.bytes, pad + size, __ATOMIC_RELAXED);
+	return 0;
+}
+
+static void*
+_export_thread(void* arg)
+{
+	char*			record		= NULL;
+	size_t			capacity	= 0;
+	char*			fp_data		= NULL;
+	size_t			fp_length	= 0;
+	long			index		= 0;
+	size_t			start		= 0;
+	size_t			end			= 0;
+	const char*		pcm			= NULL;
+	size_t			length		= 0;
+
+	(void)arg;
+	for (;;)
+	{
+		index = __atomic_fetch_add(&s_export.next, 1, __ATOMIC_RELAXED);
+		if (index >= s_export.num_windows)
+		{
+			break;
+		}
+
+		start = (size_t)(index * s_export.hop * s_export.sample_rate);
+		end = start + (size_t)(s_export.window * s_export.sample_rate);
+		if (end > s_export.frames)
+		{
+			end = s_export.frames;
+		}
+		pcm = s_export.pcm + start * s_export.block_align;
+		length = (end - start) * s_export.block_align;
+
+		if (_is_quiet(pcm, length))
+		{
+			__atomic_fetch_add(&s_export.quiet, 1, __ATOMIC_RELAXED);
+			continue;
+		}
+
+		if (GNFP_SUCCESS != gnfp_fingerprint(
+								s_export.session,
+								pcm,
+								length,
+								s_export.sample_rate,
+								s_export.sample_bits,
+								s_export.channels,
+								&fp_data,
+								&fp_length
+								))
+		{
+			__atomic_fetch_add(&s_export.errors, 1, __ATOMIC_RELAXED);
+			continue;
+		}
+
+		if (0 == _write_record(
+					&record,
+					&capacity,
+					(uint32_t)(index * s_export.hop * 1000 + 0.5),
+					(uint32_t)((end - start) * 1000 / s_export.sample_rate),
+					fp_data,
+					fp_length
+					))
+		{
+			__atomic_fetch_add(&s_export.written, 1, __ATOMIC_RELAXED);
+		}
+		else
+		{
+			fprintf(stderr, "Error writing fingerprint record: %s\n", strerror(errno));
+			__atomic_fetch_add(&s_export.errors, 1, __ATOMIC_RELAXED);
+		}
+		free(fp_data);
+	}
+
+	free(record);
+	return NULL;
+}
+
+/*
+*  Opens a records file for appending. A new file is written with its magic
+*  under a unique temporary name and linked into place, so a concurrent
+*  exporter can never append to it before the magic. Returns -2 if an
+*  existing file isn't a records file.
+*/
+static int
+_records_open(
+	const char*		path
+	)
+{
+	char	tmp_path[1024];
+	char	magic[8];
+	mode_t	mask	= 0;
+	int		fd		= -1;
+	int		error	= 0;
+
+	fd = open(path, O_RDWR | O_APPEND);
+	if (-1 == fd && ENOENT == errno)
+	{
+		snprintf(tmp_path, sizeof(tmp_path), "%s.XXXXXX", path);
+		fd = mkstemp(tmp_path);
+		if (-1 == fd)
+		{
+			return -1;
+		}
+		mask = umask(0);
+		umask(mask);
+		if (0 != fchmod(fd, 0666 & ~mask)
+			|| 8 != write(fd, GNFP_RECORDS_MAGIC, 8)
+			|| (0 != link(tmp_path, path) && EEXIST != errno))
+		{
+			error = errno;
+		}
+		close(fd);
+		unlink(tmp_path);
+		if (0 != error)
+		{
+			errno = error;
+			return -1;
+		}
+
+		/* Whoever created it, the file now starts with a magic */
+		fd = open(path, O_RDWR | O_APPEND);
+	}
+	if (-1 == fd)
+	{
+		return -1;
+	}
+	if (8 != pread(fd, magic, 8, 0) || 0 != memcmp(magic, GNFP_RECORDS_MAGIC, 8))
+	{
+		close(fd);
+		return -2;
+	}
+
+	return fd;
+}
+
+static int
+_export_episodes(
+	gnfp_session_t*			session,
+	const char*				records_path,
+	char**					paths,
+	long					count,
+	double					window,
+	double					hop,
+	long					min_rms
+	)
+{
+	pthread_t*		threads			= NULL;
+	const char*		value			= NULL;
+	const char*		name			= NULL;
+	const char*		dot				= NULL;
+	char*			map				= NULL;
+	size_t			map_size		= 0;
+	char			report[128];
+	long			num_threads		= 0;
+	long			started			= 0;
+	long			file_index		= 0;
+	long			i				= 0;
+	int				rc				= 0;
+
+	s_export.session = session;
+	s_export.window = window;
+	s_export.hop = hop;
+	s_export.min_rms = min_rms;
+
+	s_export.fd = _records_open(records_path);
+	if (-2 == s_export.fd)
+	{
+		printf("\n\n!!!!Not a records file: %s!!!\n\n", records_path);
+		return -1;
+	}
+	if (-1 == s_export.fd)
+	{
+		printf("\n\n!!!!Failed to open records file: %s (%s)!!!\n\n", records_path, strerror(errno));
+		return -1;
+	}
+	pthread_mutex_init(&s_export.write_mutex, NULL);
+
+	num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+	value = getenv("GNFP_EXPORT_THREADS");
+	if (NULL != value && atol(value) > 0)
+	{
+		num_threads = atol(value);
+	}
+	if (num_threads < 1)
+	{
+		num_threads = 1;
+	}
+	threads = calloc(num_threads, sizeof(pthread_t));
+	if (NULL == threads)
+	{
+		printf("Error allocating memory.\n");
+		pthread_mutex_destroy(&s_export.write_mutex);
+		close(s_export.fd);
+		return -1;
+	}
+
+	for (file_index = 0; file_index < count; file_index++)
+	{
+		if (0 != _wave_map(paths[file_index], &map, &map_size))
+		{
+			printf("\n\n!!!!Failed to open input file: %s!!!\n\n", paths[file_index]);
+			if (NULL != map)
+			{
+				munmap(map, map_size);
+				map = NULL;
+			}
+			rc = -1;
+			continue;
+		}
+
+		/* Episodes are tagged with their file name, without directory or extension */
+		name = strrchr(paths[file_index], '/');
+		name = (NULL != name) ? name + 1 : paths[file_index];
+		dot = strrchr(name, '.');
+		s_export.episode = name;
+		s_export.episode_length = (NULL != dot && dot != name) ? (size_t)(dot - name) : strlen(name);
+
+		s_export.num_windows = 0;
+		while (s_export.num_windows * hop * s_export.sample_rate < s_export.frames)
+		{
+			s_export.num_windows++;
+		}
+		s_export.next = 0;
+
+		started = 0;
+		for (i = 0; i < num_threads; i++)
+		{
+			if (0 == pthread_create(&threads[started], NULL, _export_thread, NULL))
+			{
+				started++;
+			}
+		}
+		if (0 == started)
+		{
+			_export_thread(NULL);
+		}
+		for (i = 0; i < started; i++)
+		{
+			pthread_join(threads[i], NULL);
+		}
+
+		munmap(map, map_size);
+		map = NULL;
+
+		printf("%16s %s %ld\n", "Exported:", paths[file_index], s_export.num_windows);
+		fflush(stdout);
+	}
+
+	snprintf(report, sizeof(report), "export: records=%lu quiet=%lu errors=%lu bytes=%llu threads=%ld",
+		s_export.written,
+		s_export.quiet,
+		s_export.errors,
+		s_export.bytes,
+		num_threads
+		);
+	gnfp_log(GNFP_LOG_INFO, s_export.written, s_export.bytes, report);
+
+	free(threads);
+	pthread_mutex_destroy(&s_export.write_mutex);
+	if (0 != close(s_export.fd) || 0 != s_export.errors)
+	{
+		rc = -1;
+	}
+
+	return rc;
+}
+
+static struct
+{
+	gnfp_session_t*			session;
+	const char**			records;		/* Records may be unaligned after a torn one, read headers with memcpy() */
+	long					count;
+
+	pthread_mutex_t			mutex;
+	pthread_cond_t			cond;
+	long					batch_start;
+	long					batch_end;
+	long					next;			/* Next record of the batch to look up */
+	long					done;			/* Records of the batch looked up */
+	gnfp_result_t*			results;
+	int*					rcs;
+	int						stop;
+} s_lookup;
+
+/* Adds the records of a mapped file to s_lookup.records */
+static int
+_records_index(
+	const char*		path,
+	const char*		map,
+	size_t			map_size
+	)
+{
+	_record_header_t			header;
+	const char**				records		= NULL;
+	size_t						pos			= 8;
+	size_t						bad_start	= 0;
+	unsigned long				skipped		= 0;
+	long						capacity	= s_lookup.count;
+
+	if (map_size < 8 || 0 != memcmp(map, GNFP_RECORDS_MAGIC, 8))
 	{
-		strcpy(user_filename,client_id);
-		strcat(user_filename,"_user.txt");
+		printf("\n\n!!!!Not a fingerprint records file: %s!!!\n\n", path);
+		return -1;
+	}
 
-		/* Do we have a user saved locally? */
-		file = fopen(user_filename, "r");
-		if (NULL != file)
+	while (pos + sizeof(_record_header_t) <= map_size)
+	{
+		memcpy(&header, map + pos, sizeof(header));
+		if (header.size < sizeof(_record_header_t)
+			|| header.size > map_size - pos
+			|| 0 != header.size % GNFP_RECORDS_ALIGN
+			|| (size_t)header.episode_length + header.fp_length > header.size - sizeof(_record_header_t)
+			|| header.checksum != _record_checksum(map + pos, header.size))
 		{
-			gnsdk_char_t serialized_user_string[1024] = {0};
-
-			if (NULL != (fgets(serialized_user_string, 1024, file)))
-			{
-				/* Create the user handle from the saved user */
-				error = gnsdk_manager_user_create(serialized_user_string, &user_handle);
-				if (GNSDK_SUCCESS != error)
-				{
-					_display_error(__LINE__, "gnsdk_manager_user_create()", error);
-					rc = -1;
-				}
-			}
-			else
+			/* Torn or corrupt: resync at the next byte where a record checks out */
+			if (0 == bad_start)
 			{
-				printf("Error reading user file into buffer.\n");
-				rc = -1;
+				bad_start = pos;
 			}
-			fclose(file);
+			pos++;
+			continue;
 		}
-		else
+		if (0 != bad_start)
 		{
-			printf("\nInfo: No stored user - this must be the app's first run.\n");
+			/* Fewer than 8 zeros are a writer's padding after a torn record, which was reported already */
+			while (bad_start < pos && pos - bad_start < GNFP_RECORDS_ALIGN && 0 == map[bad_start])
+			{
+				bad_start++;
+			}
+			if (bad_start < pos)
+			{
+				fprintf(stderr, "Skipped corrupt records in bytes %lu-%lu of %s\n",
+					(unsigned long)bad_start, (unsigned long)pos, path);
+				skipped += pos - bad_start;
+			}
+			bad_start = 0;
 		}
 
-		/* If not, create new one*/
-		if (GNSDK_NULL == user_handle)
+		if (s_lookup.count == capacity)
 		{
-			error = gnsdk_manager_user_create_new(
-						client_id,
-						client_id_tag,
-						client_app_version,
-						&user_handle
-						);
-			if (GNSDK_SUCCESS != error)
+			capacity = (capacity > 0) ? capacity * 2 : 1024;
+			records = realloc(s_lookup.records, capacity * sizeof(const char*));
+			if (NULL == records)
 			{
-				_display_error(__LINE__, "gnsdk_manager_user_create_new()", error);
-				rc = -1;
+				printf("Error allocating memory.\n");
+				return -1;
 			}
+			s_lookup.records = records;
 		}
-
-		free(user_filename);
+		s_lookup.records[s_lookup.count++] = map + pos;
+		pos += header.size;
 	}
-	else
+
+	if (0 != bad_start || pos != map_size)
 	{
-		printf("Error allocating memory.\n");
-		rc = -1;
+		bad_start = (0 != bad_start) ? bad_start : pos;
+		fprintf(stderr, "Ignoring incomplete record at byte %lu of %s\n", (unsigned long)bad_start, path);
+		skipped += map_size - bad_start;
 	}
-
-	if (rc == 0)
+	if (skipped > 0)
 	{
-		*p_user_handle = user_handle;
+		gnfp_log(GNFP_LOG_WARNING, skipped, map_size, "skipped corrupt fingerprint record bytes");
 	}
 
-	return rc;
+	return 0;
 }
 
-/*
-*    Display product version information.
-*/
-static void
-_display_gnsdk_product_info(void)
+/* Each worker looks records up with its own query handle */
+static void*
+_lookup_thread(void* arg)
 {
-	/* Display GNSDK Version infomation */
-	printf("\nGNSDK Product Version    : v%s \t(built %s)\n", gnsdk_manager_get_product_version(), gnsdk_manager_get_build_date());
-}
-
-/*
-*  Enable Logging
-*/
-static int
-_enable_logging(void)
-{
-	gnsdk_error_t	error	= GNSDK_SUCCESS;
-	int				rc		= 0;
-
-	error = gnsdk_manager_logging_enable(
-				"sample.log",									/* Log file path */
-				GNSDK_LOG_PKG_ALL,								/* Include entries for all packages and subsystems */
-				GNSDK_LOG_LEVEL_ERROR|GNSDK_LOG_LEVEL_WARNING,	/* Include only error and warning entries */
-				GNSDK_LOG_OPTION_ALL,							/* All logging options: timestamps, thread IDs, etc */
-				0,												/* Max size of log: 0 means a new log file will be created each run */
-				GNSDK_FALSE										/* GNSDK_TRUE = old logs will be renamed and saved */
-				);
-	if (GNSDK_SUCCESS != error)
+	gnfp_lookup_t*				lookup	= NULL;
+	_record_header_t			header;
+	gnfp_result_t				result;
+	long						index	= 0;
+	int							rc		= GNFP_SUCCESS;
+
+	(void)arg;
+	memset(&result, 0, sizeof(result));
+	if (GNFP_SUCCESS != gnfp_lookup_open(s_lookup.session, &lookup))
 	{
-		_display_error(__LINE__, "gnsdk_manager_logging_enable()", error);
-		rc = -1;
+		lookup = NULL;
 	}
 
-	return rc;
-}
-
-/*
-* Set the application Locale.
-*/
-static int
-_set_locale(
-	gnsdk_user_handle_t		user_handle
-	)
-{
-	gnsdk_locale_handle_t	locale_handle	= GNSDK_NULL;
-	gnsdk_error_t			error			= GNSDK_SUCCESS;
-	int						rc				= 0;
-
-	error = gnsdk_manager_locale_load(
-				GNSDK_LOCALE_GROUP_MUSIC,		/* Locale group */
-				GNSDK_LANG_ENGLISH,				/* Languae */
-				GNSDK_REGION_DEFAULT,			/* Region */
-				GNSDK_DESCRIPTOR_SIMPLIFIED,	/* Descriptor */
-				user_handle,					/* User handle */
-				GNSDK_NULL,						/* User callback function */
-				0,								/* Optional data for user callback function */
-				&locale_handle					/* Return handle */
-				);
-	if (GNSDK_SUCCESS == error)
+	pthread_mutex_lock(&s_lookup.mutex);
+	for (;;)
 	{
-		/* Setting the 'locale' as default
-		 * If default not set, no locale-specific results would be available
-		 */
-		error = gnsdk_manager_locale_set_group_default(locale_handle);
-		if (GNSDK_SUCCESS != error)
+		if (s_lookup.next >= s_lookup.batch_end)
 		{
-			_display_error(__LINE__, "gnsdk_manager_locale_set_group_default()", error);
-			rc = -1;
+			if (s_lookup.stop)
+			{
+				break;
+			}
+			pthread_cond_wait(&s_lookup.cond, &s_lookup.mutex);
+			continue;
 		}
+		index = s_lookup.next++;
+		pthread_mutex_unlock(&s_lookup.mutex);
 
-		/* The manager will hold onto the locale when set as default
-		 * so it's ok to release our reference to it here
-		 */
-		gnsdk_manager_locale_release(locale_handle);
-	}
-	else
-	{
-		_display_error(__LINE__, "gnsdk_manager_locale_load()", error);
-		rc = -1;
+		memcpy(&header, s_lookup.records[index], sizeof(header));
+		rc = GNFP_ERROR;
+		if (NULL != lookup)
+		{
+			rc = gnfp_lookup(
+					lookup,
+					s_lookup.records[index] + sizeof(header) + header.episode_length,
+					header.fp_length,
+					&result
+					);
+		}
+
+		pthread_mutex_lock(&s_lookup.mutex);
+		s_lookup.results[index - s_lookup.batch_start] = result;
+		s_lookup.rcs[index - s_lookup.batch_start] = rc;
+		s_lookup.done++;
+		pthread_cond_broadcast(&s_lookup.cond);
 	}
+	pthread_mutex_unlock(&s_lookup.mutex);
 
-	return rc;
+	gnfp_lookup_close(lookup);
+	return NULL;
 }
 
-/*
-*     Initializing the GNSDK is required before any other APIs can be called.
-*     First step is to always initialize the Manager module, then use the returned
-*     handle to initialize any modules to be used by the application.
-*
-*     For this sample, we also load a locale which is used by GNSDK to provide
-*     appropriate locale-sensitive metadata for certain metadata values. Loading of the
-*     locale is done here for sample convenience but can be done at anytime in your
-*     application.
-*/
 static int
-_init_gnsdk(
-	const char*				client_id,
-	const char*				client_id_tag,
-	const char*				client_app_version,
-	const char*				license_path,
-	gnsdk_user_handle_t*	p_user_handle
+_lookup_records(
+	gnfp_session_t*			session,
+	char**					paths,
+	long					count
 	)
 {
-	gnsdk_manager_handle_t	sdkmgr_handle	= GNSDK_NULL;
-	gnsdk_error_t			error			= GNSDK_SUCCESS;
-	gnsdk_user_handle_t		user_handle		= GNSDK_NULL;
-	int						rc				= 0;
-
-	/* Display GNSDK Product Version Info */
-	/* _display_gnsdk_product_info(); */
-
-	/* Initialize the GNSDK Manager */
-	error = gnsdk_manager_initialize(
-				&sdkmgr_handle,
-				license_path,
-				GNSDK_MANAGER_LICENSEDATA_FILENAME
-				);
-	if (GNSDK_SUCCESS != error)
+	_record_header_t			header;
+	const gnfp_result_t*		result			= NULL;
+	pthread_t*					threads			= NULL;
+	const char*					value			= NULL;
+	char**						maps			= NULL;
+	size_t*						map_sizes		= NULL;
+	struct stat					file_stat;
+	char						report[128];
+	long						num_threads		= 4;
+	long						batch_size		= 1000;
+	long						started			= 0;
+	long						batch_start		= 0;
+	long						matched			= 0;
+	long						errors			= 0;
+	long						i				= 0;
+	int							fd				= -1;
+	int							rc				= 0;
+
+	value = getenv("GNFP_LOOKUP_THREADS");
+	if (NULL != value && atol(value) > 0)
 	{
-		_display_error(__LINE__, "gnsdk_manager_initialize()", error);
-		rc = -1;
+		num_threads = atol(value);
+	}
+	value = getenv("GNFP_LOOKUP_BATCH");
+	if (NULL != value && atol(value) > 0)
+	{
+		batch_size = atol(value);
 	}
 
-	/* Enable logging */
-	if (0 == rc)
+	s_lookup.session = session;
+	maps = calloc(count, sizeof(char*));
+	map_sizes = calloc(count, sizeof(size_t));
+	threads = calloc(num_threads, sizeof(pthread_t));
+	s_lookup.results = calloc(batch_size, sizeof(gnfp_result_t));
+	s_lookup.rcs = calloc(batch_size, sizeof(int));
+	if (NULL == maps || NULL == map_sizes || NULL == threads || NULL == s_lookup.results || NULL == s_lookup.rcs)
 	{
-		rc = _enable_logging();
+		printf("Error allocating memory.\n");
+		rc = -1;
 	}
 
-	/* Initialize the Storage SQLite Library */
-	if (0 == rc)
+	/* Map every file and index its records */
+	for (i = 0; 0 == rc && i < count; i++)
 	{
-		error = gnsdk_storage_sqlite_initialize(sdkmgr_handle);
-		if (GNSDK_SUCCESS != error)
+		fd = open(paths[i], O_RDONLY);
+		if (-1 == fd || 0 != fstat(fd, &file_stat))
 		{
-			_display_error(__LINE__, "gnsdk_storage_sqlite_initialize()", error);
+			printf("\n\n!!!!Failed to open input file: %s!!!\n\n", paths[i]);
 			rc = -1;
 		}
+		else if (file_stat.st_size > 0)
+		{
+			maps[i] = mmap(NULL, file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+			if (MAP_FAILED == maps[i])
+			{
+				maps[i] = NULL;
+				rc = -1;
+			}
+			else
+			{
+				map_sizes[i] = file_stat.st_size;
+				madvise(maps[i], map_sizes[i], MADV_SEQUENTIAL);
+				rc = _records_index(paths[i], maps[i], map_sizes[i]);
+			}
+		}
+		if (-1 != fd)
+		{
+			close(fd);
+		}
 	}
 
-	/* Initialize the DSP Library - used for generating fingerprints */
 	if (0 == rc)
 	{
-		error = gnsdk_dsp_initialize(sdkmgr_handle);
-		if (GNSDK_SUCCESS != error)
+		pthread_mutex_init(&s_lookup.mutex, NULL);
+		pthread_cond_init(&s_lookup.cond, NULL);
+		for (i = 0; i < num_threads; i++)
+		{
+			if (0 == pthread_create(&threads[started], NULL, _lookup_thread, NULL))
+			{
+				started++;
+			}
+		}
+		if (0 == started)
 		{
-			_display_error(__LINE__, "gnsdk_dsp_initialize()", error);
+			printf("Error starting lookup threads.\n");
 			rc = -1;
 		}
 	}
 
-	/* Initialize the MusicID Library */
-	if (0 == rc)
+	/* Hand out one batch at a time and print it in file order */
+	for (batch_start = 0; 0 == rc && batch_start < s_lookup.count; batch_start += batch_size)
 	{
-		error = gnsdk_musicid_initialize(sdkmgr_handle);
-		if (GNSDK_SUCCESS != error)
+		pthread_mutex_lock(&s_lookup.mutex);
+		s_lookup.batch_start = batch_start;
+		s_lookup.batch_end = batch_start + batch_size;
+		if (s_lookup.batch_end > s_lookup.count)
 		{
-			_display_error(__LINE__, "gnsdk_musicid_initialize()", error);
-			rc = -1;
+			s_lookup.batch_end = s_lookup.count;
 		}
-	}
+		s_lookup.next = batch_start;
+		s_lookup.done = 0;
+		pthread_cond_broadcast(&s_lookup.cond);
+		while (s_lookup.done < s_lookup.batch_end - batch_start)
+		{
+			pthread_cond_wait(&s_lookup.cond, &s_lookup.mutex);
+		}
+		pthread_mutex_unlock(&s_lookup.mutex);
 
-	/* Get a user handle for our client ID.  This will be passed in for all queries */
-	if (0 == rc)
-	{
-		rc = _get_user_handle(
-				client_id,
-				client_id_tag,
-				client_app_version,
-				&user_handle
-				);
-	}
+		for (i = batch_start; i < s_lookup.batch_end; i++)
+		{
+			memcpy(&header, s_lookup.records[i], sizeof(header));
+			result = &s_lookup.results[i - batch_start];
 
-	/* Set the 'locale' to return locale-specifc results values. This examples loads an English locale. */
-	if (0 == rc)
-	{
-		rc = _set_locale(user_handle);
+			printf("%16s %.3f %.*s\n", "Window:", header.offset_ms / 1000.0,
+				(int)header.episode_length, s_lookup.records[i] + sizeof(header));
+			if (GNFP_SUCCESS != s_lookup.rcs[i - batch_start])
+			{
+				errors++;
+			}
+			else if (!result->matched)
+			{
+				printf("\nNo tracks found for the input.\n");
+			}
+			else
+			{
+				matched++;
+				printf( "%16s\n", "Final track:");
+				printf( "%16s %s\n", "Artist:", result->artist );
+				printf( "%16s %s\n", "Album:", result->album );
+				printf( "%16s %s\n", "Title:", result->title );
+			}
+		}
+		fflush(stdout);
 	}
 
-	if (0 != rc)
+	if (started > 0)
 	{
-		/* Clean up on failure. */
-		_shutdown_gnsdk(user_handle, client_id);
+		pthread_mutex_lock(&s_lookup.mutex);
+		s_lookup.stop = 1;
+		pthread_cond_broadcast(&s_lookup.cond);
+		pthread_mutex_unlock(&s_lookup.mutex);
+		for (i = 0; i < started; i++)
+		{
+			pthread_join(threads[i], NULL);
+		}
+		pthread_cond_destroy(&s_lookup.cond);
+		pthread_mutex_destroy(&s_lookup.mutex);
 	}
-	else
+
+	snprintf(report, sizeof(report), "lookup: records=%ld matched=%ld errors=%ld threads=%ld batch=%ld",
+		s_lookup.count,
+		matched,
+		errors,
+		started,
+		batch_size
+		);
+	gnfp_log(GNFP_LOG_INFO, s_lookup.count, matched, report);
+
+	for (i = 0; NULL != maps && i < count; i++)
 	{
-		/* return the User handle for use at query time */
-		*p_user_handle = user_handle;
+		if (NULL != maps[i])
+		{
+			munmap(maps[i], map_sizes[i]);
+		}
 	}
+	free(maps);
+	free(map_sizes);
+	free(threads);
+	free(s_lookup.records);
+	free(s_lookup.results);
+	free(s_lookup.rcs);
 
 	return rc;
 }
 
 /*
-*     Call shutdown all initialized GNSDK modules.
-*     Release all existing handles before shutting down any of the modules.
-*     Shutting down the Manager module should occur last, but the shutdown ordering of
-*     all other modules does not matter.
+*  Live streams, see the description at the top of the file.
 */
+static struct
+{
+	gnfp_session_t*			session;
+	_live_slot_t*			slots;
+	int						num_slots;
+	size_t					window_bytes;
+	unsigned int			sample_rate;
+	unsigned int			sample_bits;
+	unsigned int			channels;
+
+	pthread_mutex_t			mutex;
+	pthread_cond_t			cond;
+	int						stop;
+	int						reporting;		/* A worker is reporting, see _live_thread */
+	long long				next_sequence;	/* Given to the next queued window */
+	long long				next_report;	/* Sequence of the next window to report */
+
+	gnfp_result_t			current;		/* Last reported track */
+	int						has_current;
+	int						misses;			/* Windows in a row without a match */
+	double					miss_start;
+
+	unsigned long			windows;
+	unsigned long			dropped;
+	unsigned long			matched;
+	unsigned long			changes;
+	unsigned long			errors;
+	double					latency_sum;	/* From a window's last byte to its result */
+	double					latency_max;
+} s_live;
+
 static void
-_shutdown_gnsdk(
-	gnsdk_user_handle_t		user_handle,
-	const char*				client_id
+_live_print_change(
+	double					start,
+	const gnfp_result_t*	result
 	)
 {
-	gnsdk_error_t	error							= GNSDK_SUCCESS;
-	gnsdk_str_t		updated_serialized_user_string	= GNSDK_NULL;
-	char*			user_filename					= GNSDK_NULL;
-	size_t			user_filename_len				= 0;
-	int				rc								= 0;
-	int				return_value					= 0;
-	FILE*			file							= NULL;
-
-	/* Release our user handle and see if we need to update our stored version */
-	error = gnsdk_manager_user_release(user_handle, &updated_serialized_user_string);
-	if (GNSDK_SUCCESS != error)
+	printf("%16s %.3f\n", "Change:", start);
+	if (NULL == result)
 	{
-		_display_error(__LINE__, "gnsdk_manager_user_release()", error);
+		printf("\nNo tracks found for the input.\n");
 	}
-	else if (GNSDK_NULL != updated_serialized_user_string)
+	else
 	{
-		user_filename_len = strlen(client_id)+strlen("_user.txt")+1;
-		user_filename = malloc(user_filename_len);
-
-		if (NULL != user_filename)
-		{
-			strcpy(user_filename,client_id);
-			strcat(user_filename,"_user.txt");
-
-			file = fopen(user_filename, "w");
-			if (NULL != file)
-			{
-				return_value = fputs(updated_serialized_user_string, file);
-				if (0 > return_value)
-				{
-					printf("Error writing user registration file from buffer.\n");
-					rc = -1;
-				}
-				fclose(file);
-			}
-			else
-			{
-				printf("\nError: Failed to open the user filename for use in saving the updated serialized user. (%s)\n", user_filename);
-			}
-			free(user_filename);
-		}
-		else
-		{
-			printf("\nError: Failed to allocated user filename for us in saving the updated serialized user.\n");
-		}
-		gnsdk_manager_string_free(updated_serialized_user_string);
+		printf( "%16s\n", "Final track:");
+		printf( "%16s %s\n", "Artist:", result->artist );
+		printf( "%16s %s\n", "Album:", result->album );
+		printf( "%16s %s\n", "Title:", result->title );
 	}
-
-	/* Shutdown the libraries */
-	gnsdk_dsp_shutdown();
-	gnsdk_musicid_shutdown();
-	gnsdk_storage_sqlite_shutdown();
-	gnsdk_manager_shutdown();
+	fflush(stdout);
 }
 
-static void
-_display_track_gdo(
-	gnsdk_gdo_handle_t track_gdo
+/*
+*  Accounts for finished windows in stream order until one changes the track;
+*  fills in the change and returns 1, or returns 0 when no window is ready.
+*  Called with the mutex held, the change is printed after unlocking.
+*/
+static int
+_live_report(
+	double*					change_start,
+	gnfp_result_t*			change
 	)
 {
-	gnsdk_error_t		error		= GNSDK_SUCCESS;
-	gnsdk_gdo_handle_t	title_gdo	= GNSDK_NULL;
-	gnsdk_gdo_handle_t	album_gdo	= GNSDK_NULL;
-	gnsdk_gdo_handle_t	artist_gdo	= GNSDK_NULL;
-	gnsdk_cstr_t		value		= GNSDK_NULL;
+	_live_slot_t*	slot		= NULL;
+	unsigned long	changes		= s_live.changes;
+	double			latency		= 0;
+	int				i			= 0;
 
-	/* track Artist */
-	error = gnsdk_manager_gdo_child_get( track_gdo, GNSDK_GDO_CHILD_ARTIST, 1, &artist_gdo );
-	if (GNSDK_SUCCESS == error)
+	for (;;)
 	{
-		error = gnsdk_manager_gdo_child_get( artist_gdo, GNSDK_GDO_CHILD_NAME_OFFICIAL, 1, &title_gdo );
-		if (GNSDK_SUCCESS == error)
+		slot = NULL;
+		for (i = 0; i < s_live.num_slots && NULL == slot; i++)
 		{
-			error = gnsdk_manager_gdo_value_get( title_gdo, GNSDK_GDO_VALUE_DISPLAY, 1, &value );
-			if (GNSDK_SUCCESS == error)
+			if (_LIVE_DONE == s_live.slots[i].state && s_live.next_report == s_live.slots[i].sequence)
 			{
-				printf( "%16s %s\n", "Artist:", value );
+				slot = &s_live.slots[i];
 			}
-			else
-			{
-				_display_error(__LINE__, "gnsdk_manager_gdo_value_get(GNSDK_GDO_VALUE_DISPLAY artist)", error);
-			}
-			gnsdk_manager_gdo_release(title_gdo);
 		}
-		else
+		if (NULL == slot)
 		{
-			_display_error(__LINE__, "gnsdk_manager_gdo_child_get(GNSDK_GDO_CHILD_TITLE_OFFICIAL artist)", error);
+			return 0;
 		}
-		gnsdk_manager_gdo_release(artist_gdo);
-	}
-	else
-	{
-		_display_error(__LINE__, "gnsdk_manager_gdo_child_get(GNSDK_GDO_CHILD_ALBUM track)", error);
-	}
 
-	/* track Album */
-	error = gnsdk_manager_gdo_child_get( track_gdo, GNSDK_GDO_CHILD_ALBUM, 1, &album_gdo );
-	if (GNSDK_SUCCESS == error)
-	{
-		error = gnsdk_manager_gdo_child_get( album_gdo, GNSDK_GDO_CHILD_TITLE_OFFICIAL, 1, &title_gdo );
-		if (GNSDK_SUCCESS == error)
+		latency = _now_seconds() - slot->received;
+		s_live.latency_sum += latency;
+		if (latency > s_live.latency_max)
+		{
+			s_live.latency_max = latency;
+		}
+
+		if (GNFP_SUCCESS != slot->rc)
 		{
-			error = gnsdk_manager_gdo_value_get( title_gdo, GNSDK_GDO_VALUE_DISPLAY, 1, &value );
-			if (GNSDK_SUCCESS == error)
+			s_live.errors++;
+		}
+		else if (slot->result.matched)
+		{
+			s_live.matched++;
+			s_live.misses = 0;
+			if (!s_live.has_current
+				|| 0 != strcmp(slot->result.artist, s_live.current.artist)
+				|| 0 != strcmp(slot->result.title, s_live.current.title))
 			{
-				printf( "%16s %s\n", "Album:", value );
+				*change_start = slot->start;
+				*change = slot->result;
+				s_live.current = slot->result;
+				s_live.has_current = 1;
+				s_live.changes++;
 			}
-			else
+		}
+		else
+		{
+			if (0 == s_live.misses++)
+			{
+				s_live.miss_start = slot->start;
+			}
+			if (s_live.has_current && GNFP_LIVE_MISSES == s_live.misses)
 			{
-				_display_error(__LINE__, "gnsdk_manager_gdo_value_get(GNSDK_GDO_VALUE_DISPLAY album)", error);
+				*change_start = s_live.miss_start;
+				memset(change, 0, sizeof(*change));
+				s_live.has_current = 0;
+				s_live.changes++;
 			}
-			gnsdk_manager_gdo_release(title_gdo);
 		}
-		else
+
+		slot->state = _LIVE_FREE;
+		s_live.next_report++;
+		if (s_live.changes != changes)
 		{
-			_display_error(__LINE__, "gnsdk_manager_gdo_child_get(GNSDK_GDO_CHILD_TITLE_OFFICIAL album)", error);
+			return 1;
 		}
-		gnsdk_manager_gdo_release(album_gdo);
-	}
-	else
-	{
-		_display_error(__LINE__, "gnsdk_manager_gdo_child_get(GNSDK_GDO_CHILD_ALBUM track)", error);
 	}
+}
 
-	/* track Title */
-	error = gnsdk_manager_gdo_child_get( track_gdo, GNSDK_GDO_CHILD_TITLE_OFFICIAL, 1, &title_gdo );
-	if (GNSDK_SUCCESS == error)
+static void*
+_live_thread(void* arg)
+{
+	_live_slot_t*	slot			= NULL;
+	gnfp_result_t	change;
+	double			change_start	= 0;
+	int				i				= 0;
+
+	(void)arg;
+	pthread_mutex_lock(&s_live.mutex);
+	for (;;)
 	{
-		error = gnsdk_manager_gdo_value_get( title_gdo, GNSDK_GDO_VALUE_DISPLAY, 1, &value );
-		if (GNSDK_SUCCESS == error)
+		slot = NULL;
+		for (i = 0; i < s_live.num_slots && NULL == slot; i++)
 		{
-			printf( "%16s %s\n", "Title:", value );
+			if (_LIVE_QUEUED == s_live.slots[i].state)
+			{
+				slot = &s_live.slots[i];
+			}
 		}
-		else
+		if (NULL == slot)
 		{
-			_display_error(__LINE__, "gnsdk_manager_gdo_value_get()", error);
+			if (s_live.stop)
+			{
+				break;
+			}
+			pthread_cond_wait(&s_live.cond, &s_live.mutex);
+			continue;
+		}
+
+		slot->state = _LIVE_QUERYING;
+		pthread_mutex_unlock(&s_live.mutex);
+
+		slot->rc = gnfp_identify(
+						s_live.session,
+						slot->pcm,
+						s_live.window_bytes,
+						s_live.sample_rate,
+						s_live.sample_bits,
+						s_live.channels,
+						&slot->result
+						);
+
+		pthread_mutex_lock(&s_live.mutex);
+		slot->state = _LIVE_DONE;
+
+		/*
+		*  Print without the mutex so a slow stdout can't stall _live_queue and
+		*  drop windows. One worker reports at a time so changes stay in order;
+		*  windows the others finish meanwhile are picked up by its loop.
+		*/
+		if (!s_live.reporting)
+		{
+			s_live.reporting = 1;
+			while (_live_report(&change_start, &change))
+			{
+				pthread_mutex_unlock(&s_live.mutex);
+				_live_print_change(change_start, change.matched ? &change : NULL);
+				pthread_mutex_lock(&s_live.mutex);
+			}
+			s_live.reporting = 0;
 		}
-		gnsdk_manager_gdo_release(title_gdo);
-	}
-	else
-	{
-		_display_error(__LINE__, "gnsdk_manager_gdo_child_get()", error);
 	}
+	pthread_mutex_unlock(&s_live.mutex);
+
+	return NULL;
 }
 
+/* Copies the window that ends at the ring's write position to a free slot, or drops it */
 static void
-_display_for_resolve(
-	gnsdk_gdo_handle_t		response_gdo
+_live_queue(
+	const char*		ring,
+	size_t			write_pos,
+	double			start
 	)
 {
-	gnsdk_error_t			error				= GNSDK_SUCCESS;
-	gnsdk_gdo_handle_t		track_gdo			= GNSDK_NULL;
-	gnsdk_uint32_t			track_count			= 0;
-	gnsdk_uint32_t			track_ordinal		= 0;
+	_live_slot_t*	slot	= NULL;
+	int				i		= 0;
 
-	error = gnsdk_manager_gdo_child_count(response_gdo, GNSDK_GDO_CHILD_TRACK, &track_count);
-	if (GNSDK_SUCCESS == error)
+	pthread_mutex_lock(&s_live.mutex);
+	s_live.windows++;
+	for (i = 0; i < s_live.num_slots && NULL == slot; i++)
 	{
-		printf( "%16s %d\n", "Match count:", track_count);
-
-		/*	Note that the GDO accessors below are *ordinal* based, not index based.  so the 'first' of
-			*	anything has a one-based ordinal of '1' - *not* an index of '0'
-			*/
-		for (track_ordinal = 1; track_ordinal <= track_count; track_ordinal++)
+		if (_LIVE_FREE == s_live.slots[i].state)
 		{
-			/* Get the track GDO */
-			error = gnsdk_manager_gdo_child_get( response_gdo, GNSDK_GDO_CHILD_TRACK, track_ordinal, &track_gdo );
-			if (GNSDK_SUCCESS == error)
-			{
-				_display_track_gdo(track_gdo);
-
-				/* Release the current track */
-				gnsdk_manager_gdo_release(track_gdo);
-				track_gdo = GNSDK_NULL;
-			}
-			else
-			{
-				_display_error(__LINE__, "gnsdk_manager_gdo_child_get()", error);
-			}
+			slot = &s_live.slots[i];
 		}
 	}
+
+	if (NULL == slot)
+	{
+		/* Counted for the report at the end; a warning each would grow the log without bound */
+		s_live.dropped++;
+		gnfp_log(GNFP_LOG_DEBUG, (long long)(start * 1000), s_live.dropped, "live: window dropped, queries are behind real time");
+	}
 	else
 	{
-		_display_error(__LINE__, "gnsdk_manager_gdo_child_count()", error);
+		memcpy(slot->pcm, ring + write_pos, s_live.window_bytes - write_pos);
+		memcpy(slot->pcm + s_live.window_bytes - write_pos, ring, write_pos);
+		slot->sequence = s_live.next_sequence++;
+		slot->start = start;
+		slot->received = _now_seconds();
+		slot->state = _LIVE_QUEUED;
+		pthread_cond_broadcast(&s_live.cond);
 	}
+	pthread_mutex_unlock(&s_live.mutex);
 }
 
-static gnsdk_uint32_t
-_do_match_selection(gnsdk_gdo_handle_t response_gdo)
-{
-	/*
-	This is where any matches that need resolution/disambiguation are iterated
-	and a single selection of the best match is made.
-
-	For this simplified sample, we'll just echo the matches and select the first match.
-	*/
-	/* _display_for_resolve(response_gdo); */
-
-	return 1;
-}
-
-/* This function simulates streaming audio into the Query handle to generate the query fingerprint */
 static int
-_set_query_fingerprint(
-	gnsdk_musicid_query_handle_t	query_handle,
-	gnsdk_cstr_t 					file
+_live_stream(
+	gnfp_session_t*			session,
+	const char*				path,
+	double					window,
+	double					cadence,
+	unsigned int			sample_rate,
+	unsigned int			sample_bits,
+	unsigned int			channels
 	)
 {
-	gnsdk_error_t				error					= GNSDK_SUCCESS;
-	gnsdk_bool_t* 				p_blocks_complete		= NULL;
-	size_t						read					= 0;
-	FILE*						p_file					= NULL;
-	char						pcm_audio[2048]			= {0};
-	int							rc						= 0;
+	pthread_t*			threads			= NULL;
+	const char*			value			= NULL;
+	char*				ring			= NULL;
+	char				report[128];
+	size_t				frame_bytes		= 0;
+	size_t				cadence_bytes	= 0;
+	size_t				write_pos		= 0;
+	size_t				read_size		= 0;
+	unsigned long long	total			= 0;		/* Bytes read from the stream */
+	unsigned long long	next_query		= 0;		/* Stream position of the next window's end */
+	ssize_t				read_len		= 0;
+	int					num_threads		= 2;
+	int					started			= 0;
+	int					fd				= 0;
+	int					i				= 0;
+	int					rc				= 0;
+
+	value = getenv("GNFP_LIVE_THREADS");
+	if (NULL != value && atoi(value) > 0)
+	{
+		num_threads = atoi(value);
+	}
 
-	 /* check file for existence */
-	p_file = fopen(file, "rb");
-	if (p_file == NULL)
+	frame_bytes = (sample_bits / 8) * channels;
+	s_live.session = session;
+	s_live.sample_rate = sample_rate;
+	s_live.sample_bits = sample_bits;
+	s_live.channels = channels;
+	s_live.window_bytes = (size_t)(window * sample_rate) * frame_bytes;
+	cadence_bytes = (size_t)(cadence * sample_rate) * frame_bytes;
+	if (0 == s_live.window_bytes || 0 == cadence_bytes)
 	{
-		printf("\n\n!!!!Failed to open input file: %s!!!\n\n", file);
+		printf("\n\n!!!!Window and cadence must be at least one frame!!!\n\n");
 		return -1;
 	}
 
-	 /* skip the wave header (first 44 bytes). we know the format of our sample files */
-	if (0 != fseek(p_file, 44, SEEK_SET))
+	if (0 != strcmp(path, "-"))
 	{
-		fclose(p_file);
-		return -1;
+		fd = open(path, O_RDONLY);
+		if (-1 == fd)
+		{
+			printf("\n\n!!!!Failed to open input file: %s!!!\n\n", path);
+			return -1;
+		}
 	}
 
-	 /* initialize the fingerprinter
-	Note: The sample file shipped is a 44100Hz 16-bit stereo (2 channel) wav file */
-	error = gnsdk_musicid_query_fingerprint_begin(
-				query_handle,
-				GNSDK_MUSICID_FP_DATA_TYPE_GNFPX,
-				44100,
-				16,
-				2
-				);
-	if (GNSDK_SUCCESS != error)
+	/* All memory is allocated up front: the ring and one window per worker */
+	ring = malloc(s_live.window_bytes);
+	threads = calloc(num_threads, sizeof(pthread_t));
+	s_live.slots = calloc(num_threads, sizeof(_live_slot_t));
+	for (i = 0; NULL != s_live.slots && i < num_threads; i++)
 	{
-		_display_error(__LINE__, "gnsdk_musicidfile_fileinfo_fingerprint_begin()", error);
-		fclose(p_file);
-		return -1;
+		s_live.slots[i].pcm = malloc(s_live.window_bytes);
+		if (NULL == s_live.slots[i].pcm)
+		{
+			rc = -1;
+		}
+	}
+	if (NULL == ring || NULL == threads || NULL == s_live.slots || 0 != rc)
+	{
+		printf("Error allocating memory.\n");
+		rc = -1;
 	}
 
-	read = fread(pcm_audio, sizeof(char), 2048, p_file);
-	while (read > 0)
+	if (0 == rc)
 	{
-		 /* write audio to the fingerprinter */
-		error = gnsdk_musicid_query_fingerprint_write(
-					query_handle,
-					pcm_audio,
-					read,
-					p_blocks_complete /* TODO: if this comes back as true, we have finished */
-					);
-		if (GNSDK_SUCCESS != error)
+		s_live.num_slots = num_threads;
+		pthread_mutex_init(&s_live.mutex, NULL);
+		pthread_cond_init(&s_live.cond, NULL);
+		for (i = 0; i < num_threads; i++)
 		{
-			if (GNSDKERR_SEVERE(error)) /* 'aborted' warnings could come back from write which should be expected */
+			if (0 == pthread_create(&threads[started], NULL, _live_thread, NULL))
 			{
-				_display_error(__LINE__, "gnsdk_musicidfile_fileinfo_fingerprint_write()", error);
+				started++;
 			}
+		}
+		if (0 == started)
+		{
+			printf("Error starting query threads.\n");
 			rc = -1;
-			break;
 		}
-
-		read = fread(pcm_audio, sizeof(char), 2048, p_file);
 	}
 
-	fclose(p_file);
-
-	 /*signal that we are done*/
-	if (GNSDK_SUCCESS == error)
+	/* Read up to each window's end at a time, so the ring holds exactly that window when it is queued */
+	next_query = s_live.window_bytes;
+	while (0 == rc)
 	{
-		error = gnsdk_musicid_query_fingerprint_end(query_handle);
-		if (GNSDK_SUCCESS != error)
+		read_size = s_live.window_bytes - write_pos;
+		if (read_size > next_query - total)
 		{
-			_display_error(__LINE__, "gnsdk_musicidfile_fileinfo_fingerprint_end()", error);
+			read_size = next_query - total;
 		}
-	}
-
-	return rc;
-}
-
-/*
- * This function performs a fingerprint lookup
- */
-static void
-_do_sample_musicid_stream(
-	gnsdk_user_handle_t     user_handle,
-	char*					file_path
-	)
-{
-	gnsdk_error_t						error = GNSDK_SUCCESS;
-	gnsdk_musicid_query_handle_t		query_handle = GNSDK_NULL;
-	gnsdk_gdo_handle_t					response_gdo = GNSDK_NULL;
-	gnsdk_gdo_handle_t					track_gdo = GNSDK_NULL;
-	gnsdk_gdo_handle_t					followup_response_gdo = GNSDK_NULL;
-	gnsdk_uint32_t						count					= 0;
-	gnsdk_uint32_t						choice_ordinal			= 0;
-	gnsdk_cstr_t						needs_decision			= GNSDK_NULL;
-	gnsdk_cstr_t						is_full					= GNSDK_NULL;
-	int									rc						= 0;
-
-	/* printf("\n*****Sample MID-Stream Query*****\n"); */
-
-	/* Create the query handle */
-	error = gnsdk_musicid_query_create(
-				user_handle,
-				GNSDK_NULL,	 /* User callback function */
-				GNSDK_NULL,	 /* Optional data to be passed to the callback */
-				&query_handle
-				);
 
-	/* Set the input fingerprint. */
-	if (GNSDK_SUCCESS == error)
-	{
-		rc = _set_query_fingerprint(query_handle, file_path);
-		if (0 == rc)
+		read_len = read(fd, ring + write_pos, read_size);
+		if (read_len < 0 && EINTR == errno)
 		{
-			/* Perform the query */
-			error = gnsdk_musicid_query_find_tracks(
-						query_handle,
-						&response_gdo
-						);
-			if (GNSDK_SUCCESS != error)
+			continue;
+		}
+		if (read_len <= 0)
+		{
+			if (read_len < 0)
 			{
-				_display_error(__LINE__, "gnsdk_musicid_query_find_tracks()", error);
+				fprintf(stderr, "Error reading the stream: %s\n", strerror(errno));
+				rc = -1;
 			}
+			break;
+		}
 
-			/* See how many tracks were found. */
-			if (GNSDK_SUCCESS == error)
-			{
-				error = gnsdk_manager_gdo_child_count(
-								response_gdo,
-								GNSDK_GDO_CHILD_TRACK,
-								&count
-								);
-				if (GNSDK_SUCCESS != error)
-				{
-					_display_error(__LINE__, "gnsdk_manager_gdo_child_count(GNSDK_GDO_CHILD_TRACK)", error);
-				}
-			}
+		total += read_len;
+		write_pos = (write_pos + read_len) % s_live.window_bytes;
 
-			/* See if we need any follow-up queries or disambiguation */
-			if (GNSDK_SUCCESS == error)
-			{
-				if (count == 0)
-				{
-					printf("\nNo tracks found for the input.\n");
-				}
-				else
-				{
-					/* we have at least one track, see if disambiguation (match resolution) is necessary. */
-					error = gnsdk_manager_gdo_value_get(
-								response_gdo,
-								GNSDK_GDO_VALUE_RESPONSE_NEEDS_DECISION,
-								1,
-								&needs_decision
-								);
-					if (GNSDK_SUCCESS != error)
-					{
-						_display_error(__LINE__, "gnsdk_manager_gdo_value_get(GNSDK_GDO_VALUE_RESPONSE_NEEDS_DECISION)", error);
-					}
-					else
-					{
-						/* See if selection of one of the tracks needs to happen */
-						if (0 == strcmp(needs_decision, GNSDK_VALUE_TRUE))
-						{
-							choice_ordinal = _do_match_selection(response_gdo);
-						}
-						else
-						{
-							/* no need for disambiguation, we'll take the first track */
-							choice_ordinal = 1;
-						}
-
-						error = gnsdk_manager_gdo_child_get(
-									response_gdo,
-									GNSDK_GDO_CHILD_TRACK,
-									choice_ordinal,
-									&track_gdo
-									);
-						if (GNSDK_SUCCESS != error)
-						{
-							_display_error(__LINE__, "gnsdk_manager_gdo_child_get(GNSDK_GDO_CHILD_TRACK)", error);
-						}
-						else
-						{
-							/* See if the track has full data or only partial data. */
-							error = gnsdk_manager_gdo_value_get(
-										track_gdo,
-										GNSDK_GDO_VALUE_FULL_RESULT,
-										1,
-										&is_full
-										);
-							if (GNSDK_SUCCESS != error)
-							{
-								_display_error(__LINE__, "gnsdk_manager_gdo_value_get(GNSDK_GDO_VALUE_FULL_RESULT)", error);
-							}
-							else
-							{
-								/* if we only have a partial result, we do a follow-up query to retrieve the full track */
-								if (0 == strcmp(is_full, GNSDK_VALUE_FALSE))
-								{
-									/* do followup query to get full object. Setting the partial track as the query input. */
-									error = gnsdk_musicid_query_set_gdo(
-												query_handle,
-												track_gdo
-												);
-									if (GNSDK_SUCCESS != error)
-									{
-										_display_error(__LINE__, "gnsdk_musicid_query_set_gdo()", error);
-									}
-									else
-									{
-										/* we can now release the partial track */
-										gnsdk_manager_gdo_release(track_gdo);
-										track_gdo = GNSDK_NULL;
-
-										error = gnsdk_musicid_query_find_tracks(
-													query_handle,
-													&followup_response_gdo
-													);
-										if (GNSDK_SUCCESS != error)
-										{
-											_display_error(__LINE__, "gnsdk_musicid_query_find_tracks()", error);
-										}
-										else
-										{
-											/* now our first track is the desired result with full data */
-											error = gnsdk_manager_gdo_child_get(
-														followup_response_gdo,
-														GNSDK_GDO_CHILD_TRACK,
-														1,
-														&track_gdo
-														);
-
-											/* Release the followup query's response object */
-											gnsdk_manager_gdo_release(followup_response_gdo);
-										}
-									}
-								}
-							}
-
-							/* We should now have our final, full track result. */
-							if (GNSDK_SUCCESS == error)
-							{
-								printf( "%16s\n", "Final track:");
-
-								_display_track_gdo(track_gdo);
-							}
-
-							gnsdk_manager_gdo_release(track_gdo);
-							track_gdo = GNSDK_NULL;
-						 }
-					}
-				}
-			}
+		if (total == next_query)
+		{
+			_live_queue(ring, write_pos, (double)(total - s_live.window_bytes) / frame_bytes / sample_rate);
+			next_query += cadence_bytes;
+		}
+	}
+
+	/* End of stream: let the queued windows finish */
+	if (started > 0)
+	{
+		pthread_mutex_lock(&s_live.mutex);
+		s_live.stop = 1;
+		pthread_cond_broadcast(&s_live.cond);
+		pthread_mutex_unlock(&s_live.mutex);
+		for (i = 0; i < started; i++)
+		{
+			pthread_join(threads[i], NULL);
 		}
+		pthread_cond_destroy(&s_live.cond);
+		pthread_mutex_destroy(&s_live.mutex);
+
+		snprintf(report, sizeof(report),
+			"live: seconds=%.1f windows=%lu dropped=%lu matched=%lu changes=%lu errors=%lu latency_ms=%.0f/%.0f",
+			(double)total / frame_bytes / sample_rate,
+			s_live.windows,
+			s_live.dropped,
+			s_live.matched,
+			s_live.changes,
+			s_live.errors,
+			(s_live.windows > s_live.dropped) ? s_live.latency_sum * 1000 / (s_live.windows - s_live.dropped) : 0.0,
+			s_live.latency_max * 1000
+			);
+		gnfp_log(GNFP_LOG_INFO, s_live.windows, s_live.dropped, report);
+		fprintf(stderr, "%s\n", report);
 	}
 
-	/* Clean up */
-	/* Release the query handle */
-	if (GNSDK_NULL != query_handle)
+	if (0 != fd && -1 != fd)
 	{
-		gnsdk_musicid_query_release(query_handle);
+		close(fd);
 	}
-	/* Release the results */
-	if (GNSDK_NULL != response_gdo)
+	for (i = 0; NULL != s_live.slots && i < num_threads; i++)
 	{
-		gnsdk_manager_gdo_release(response_gdo);
+		free(s_live.slots[i].pcm);
 	}
+	free(s_live.slots);
+	free(threads);
+	free(ring);
+
+	return rc;
 }
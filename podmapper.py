@@ -1,3 +1,5 @@
+import atexit
+import audioop
 import collections
 import glob
 import httplib
@@ -6,15 +8,23 @@ import os
 import os.path
 import shutil
 import subprocess
+import sys
 import tempfile
-import time
+import threading
 import wave
+from multiprocessing.pool import ThreadPool
 
-from pyechonest import config as echo_nest_config, catalog as echo_nest_catalog
+from pyechonest import config as echo_nest_config
 from requests.auth import AuthBase
 import requests
 
 import config
+import downloader
+
+try:
+    import gnfingerprint  # in-process bindings, see gnfingerprintmodule.c
+except ImportError:
+    gnfingerprint = None
 
 
 echo_nest_config.ECHO_NEST_API_KEY = config.ECHO_NEST_API_KEY
@@ -30,24 +40,18 @@ class BearerAuth(AuthBase):
         return r
 
 
-def download_podcast(src_url, dst_dir):
-    """Download the MP3 file at `src_url`"""
+def download_podcast(src_url, dst_dir, consumer=None):
+    """Download the MP3 file at `src_url`.
 
-    logger = logging.getLogger('downloader')
+    ``consumer`` is called with the file's bytes, in order, while it downloads.
+    Running again with the same ``dst_dir`` resumes an interrupted download."""
 
-    r = requests.get(src_url, stream=True)
-    r.raise_for_status()
-
-    fp, dst_path = tempfile.mkstemp(prefix='episode-', suffix='.mp3', dir=dst_dir)
-    os.close(fp)
+    logger = logging.getLogger('downloader')
 
+    dst_path = downloader.episode_path(src_url, dst_dir)
     logger.info('Saving podcast to %s', dst_path)
 
-    with open(dst_path, 'wb') as fp:
-        for chunk in r.iter_content(config.DOWNLOAD_CHUNK_SIZE):
-            fp.write(chunk)
-
-    return dst_path
+    return downloader.RangedDownload(src_url, dst_path).run(consumer)
 
 
 def convert_podcast(src_path, dst_dir):
@@ -74,11 +78,56 @@ def convert_podcast(src_path, dst_dir):
         return dst_path
 
 
-def split_wave_file(src_path, dst_dir):
-    """Split the WAV file found at ``src_path`` into multiple WAV files."""
+def download_and_convert(src_url, dst_dir):
+    """Downloads ``src_url`` and decodes it to WAV while it downloads.
+
+    Returns the paths of the MP3 and the WAV files."""
+
+    logger = logging.getLogger('converter')
+
+    root, ext = os.path.splitext(os.path.basename(downloader.episode_path(src_url, dst_dir)))
+    dst_path = os.path.join(dst_dir, '%s.wav' % root)
+
+    logger.info('Saving WAV file to %s', dst_path)
+
+    decoder = subprocess.Popen([
+        'lame', '--decode',
+        '--mp3input', '-',
+        dst_path
+    ], stdin=subprocess.PIPE)
+
+    try:
+        src_path = download_podcast(src_url, dst_dir, decoder.stdin.write)
+    finally:
+        decoder.stdin.close()
+        return_code = decoder.wait()
+
+    if return_code != 0:
+        raise Exception('Decoder returned non-zero status code %s' % return_code)
+    return src_path, dst_path
+
+
+def split_wave_file(src_path, dst_dir, sample_size=None, start=0, end=None,
+                    hop=None, min_rms=None):
+    """Split the WAV file found at ``src_path`` into multiple WAV files.
+
+    Slices are ``sample_size`` seconds long and start every ``hop`` seconds,
+    from ``start`` up to ``end`` (by default the whole file). Slices quieter
+    than ``min_rms`` are not written, so they are never fingerprinted.
+    Returns the number of slices written.
+
+    ``sample_size``, ``hop`` and ``min_rms`` default to ``config.WAVE_SAMPLE_SIZE``,
+    ``config.WAVE_HOP_SIZE`` and ``config.WAVE_MIN_RMS``."""
 
     logger = logging.getLogger('spliter')
 
+    if sample_size is None:
+        sample_size = config.WAVE_SAMPLE_SIZE
+    if hop is None:
+        hop = config.WAVE_HOP_SIZE
+    if min_rms is None:
+        min_rms = config.WAVE_MIN_RMS
+
     src_path_root, ext = os.path.splitext(os.path.basename(src_path))
     slice_base_name = '%s-slice' % src_path_root
 
@@ -96,9 +145,14 @@ def split_wave_file(src_path, dst_dir):
     logger.info('number frames %s', num_frames)
     logger.info('total_length %s', total_length)
 
-    start_position = float(0)
-    while start_position < total_length:
-        end_position = float(start_position + config.WAVE_SAMPLE_SIZE)
+    last_start = total_length
+    if end is not None and end < total_length:
+        last_start = end
+
+    num_slices = 0
+    start_position = float(start)
+    while start_position < last_start:
+        end_position = float(start_position + sample_size)
 
         if end_position > total_length:
             end_position = total_length
@@ -111,8 +165,14 @@ def split_wave_file(src_path, dst_dir):
         logger.debug('chunk_length %s', chunk_length)
         chunk_data = orig_track.readframes(chunk_length)
 
-        track_slice_path = os.path.join(dst_dir, '%s-%05d_%05d.wav' % (
-            slice_base_name, start_position, end_position))
+        if min_rms and audioop.rms(chunk_data, sample_width) < min_rms:
+            logger.debug('skipping quiet slice at %s', start_position)
+            start_position += hop
+            continue
+
+        # In milliseconds, so fractional hops can't give two slices one name
+        track_slice_path = os.path.join(dst_dir, '%s-%08d_%08d.wav' % (
+            slice_base_name, round(start_position * 1000), round(end_position * 1000)))
 
         track_slice = wave.open(track_slice_path, 'w')
         track_slice.setnchannels(num_chanels)
@@ -120,27 +180,22 @@ def split_wave_file(src_path, dst_dir):
         track_slice.setframerate(frame_rate)
         track_slice.writeframes(chunk_data)
         track_slice.close()
+        num_slices += 1
 
         logger.debug('tell %s', (orig_track.tell() / frame_rate))
-        start_position = end_position
+        start_position += hop
 
     orig_track.close()
 
+    return num_slices
 
-def fingerprint_file(src_path):
-    """Fingerprints the WAV file found at ``src_path``."""
+
+def parse_fingerprint_output(src_path, output):
+    """Returns the (artist, album, track) that ``gnfingerprint`` printed, or None."""
 
     logger = logging.getLogger('fingerprint')
     matched_track = None
 
-    output = subprocess.check_output([
-        'gnfingerprint',
-        config.GRACENOTE_CLIENT_ID,
-        config.GRACENOTE_CLIENT_TAG,
-        config.GRACENOTE_LICENCE_PATH,
-        src_path,
-    ], stderr=subprocess.STDOUT)
-
     if 'No tracks found for the input' in output:
         logger.info('No tracks found for the input %s', src_path)
     elif 'Item not found' in output:
@@ -160,87 +215,134 @@ def fingerprint_file(src_path):
     return matched_track
 
 
-def fingerprint_directory(src_dir):
-    found_tracks = []
-    for slice_path in glob.glob(os.path.join(src_dir, '*.wav')):
-        found_track = fingerprint_file(slice_path)
-        if found_track is not None:
-            found_tracks.append(found_track)
-    return found_tracks
+_fingerprint_session = None
+_fingerprint_pool = None
+_fingerprint_lock = threading.Lock()
 
 
-def trim_tracks(found_tracks):
-    """Only include results of they appear more than once"""
-    results = [record for (record, count) in collections.Counter(found_tracks).most_common() if count > config.FILTER_COUNT]
-    for record in results:
-        print ' - '.join(record)
-    return results
+def _open_fingerprint_session():
+    """Returns this process' in-process Gracenote session and its thread pool."""
+    global _fingerprint_session, _fingerprint_pool
+
+    with _fingerprint_lock:
+        if _fingerprint_session is None:
+            _fingerprint_session = gnfingerprint.Session(
+                config.GRACENOTE_CLIENT_ID,
+                config.GRACENOTE_CLIENT_TAG,
+                config.GRACENOTE_LICENCE_PATH)
+            _fingerprint_pool = ThreadPool(config.FINGERPRINT_THREADS)
+            atexit.register(_close_fingerprint_session)
+        return _fingerprint_session, _fingerprint_pool
+
+
+def _close_fingerprint_session():
+    """Closes the session so that an updated Gracenote user gets saved."""
+    global _fingerprint_session, _fingerprint_pool
+
+    with _fingerprint_lock:
+        if _fingerprint_session is not None:
+            _fingerprint_pool.close()
+            _fingerprint_pool.join()
+            _fingerprint_session.close()
+            _fingerprint_session = _fingerprint_pool = None
 
 
-def update_catalog(catalog_name, tracks):
-    """Adds the ``tracks`` to the Echo Nest catalog named ``catalog_name``."""
+def _identify_in_process(session, src_path):
+    """Fingerprints the WAV file found at ``src_path`` without leaving the process."""
 
-    logger = logging.getLogger('catalog-updater')
+    logger = logging.getLogger('fingerprint')
 
-    catalog = echo_nest_catalog.Catalog(catalog_name, type='song')
+    try:
+        src = wave.open(src_path, 'r')
+        try:
+            pcm = src.readframes(src.getnframes())
+            params = (src.getframerate(), src.getsampwidth() * 8, src.getnchannels())
+        finally:
+            src.close()
+    except (IOError, EOFError, wave.Error) as e:
+        logger.error('Failed to open input file %s: %s', src_path, e)
+        return None
+
+    try:
+        matched_track = session.identify(pcm, *params)
+    except gnfingerprint.error as e:
+        logger.error('%s %s', e, src_path)
+        return None
+
+    if matched_track is None:
+        logger.info('No tracks found for the input %s', src_path)
+    else:
+        logger.info('Identified %s as %s', src_path, ' - '.join(matched_track))
+    return matched_track
 
-    items = []
-    for artist, album, title in tracks:
-        items.append({
-            'action': 'update',
-            'item': {
-                'item_id': '%s%s' % (title, artist),  # TODO: Better hash
-                'song_name': title,
-                'artist_name': artist,
-            }
-        })
 
-    catalog_ticket = catalog.update(items)
-    logger.info('Updated catalog named "%s" and got ticket "%s"', catalog_name,
-                catalog_ticket)
+def fingerprint_files(src_paths):
+    """Fingerprints the WAV files found at ``src_paths``.
 
-    return catalog_ticket
+    With the ``gnfingerprint`` Python extension installed and
+    ``config.FINGERPRINT_IN_PROCESS`` set, the files are identified in this
+    process by ``config.FINGERPRINT_THREADS`` threads. Otherwise they are
+    passed to one run of the ``gnfingerprint`` program.
 
+    Returns a list with the matched track, or None, for each file."""
 
-def check_catalog_status(catalog_name, catalog_ticket):
-    """Polls catalog ticket and blocks until it's finished."""
-    logger = logging.getLogger('catalog-check')
+    if gnfingerprint is not None and config.FINGERPRINT_IN_PROCESS:
+        session, pool = _open_fingerprint_session()
+        return pool.map(lambda src_path: _identify_in_process(session, src_path), src_paths)
 
-    catalog = echo_nest_catalog.Catalog(catalog_name, type='song')
+    output = subprocess.check_output([
+        'gnfingerprint',
+        config.GRACENOTE_CLIENT_ID,
+        config.GRACENOTE_CLIENT_TAG,
+        config.GRACENOTE_LICENCE_PATH,
+    ] + list(src_paths), stderr=subprocess.STDOUT)
 
-    completed = False
-    while not completed:
-        time.sleep(config.ECHO_NEST_SLEEP)
-        catalog_status = catalog.status(catalog_ticket)
-        completed = catalog_status['ticket_status'] == 'complete'
-        logger.info('Catalog %s, ticket %s, status %s', catalog_name,
-                    catalog_ticket, catalog_status['ticket_status'])
+    if len(src_paths) == 1:
+        return [parse_fingerprint_output(src_paths[0], output)]
 
+    # Each file's output follows a "File: <path>" line
+    sections = {}
+    src_path = None
+    for line in output.split('\n'):
+        if line.strip().startswith('File:'):
+            src_path = line.strip()[len('File:'):].strip()
+            sections[src_path] = []
+        elif src_path is not None:
+            sections[src_path].append(line)
 
-def dump_catalog(catalog_name):
-    """Songs can be: Unknown, Identified, Found"""
+    return [parse_fingerprint_output(src_path, '\n'.join(sections.get(src_path, [])))
+            for src_path in src_paths]
 
-    catalog = echo_nest_catalog.Catalog(catalog_name, type='song')
 
-    found_rdio_tracks = []
-    items = catalog.get_item_dicts(buckets=[config.ECHO_NEST_BUCKET, 'tracks'])
-    for item in items:
-        if 'artist_name' in item:
-            print item['artist_name'], '-', item['song_name']
+def fingerprint_file(src_path):
+    """Fingerprints the WAV file found at ``src_path``."""
+    return fingerprint_files([src_path])[0]
 
-            rdio_track_keys = [track['foreign_id'].split(':')[2] for track in item['tracks']]
-            if len(item['tracks']):
-                print '\t', 'Found'
-                print '\t', ', '.join(rdio_track_keys)
-                found_rdio_tracks.append(rdio_track_keys[0])
-            else:
-                print '\t', 'Identified'
-        else:
-            print item['request']['artist_name'], '-', item['request']['song_name']
-            print '\t', 'Unkonwn'
-        print
 
-    return found_rdio_tracks
+def fingerprint_directory(src_dir):
+    """Fingerprints every slice in ``src_dir``, ``config.FINGERPRINT_BATCH_SIZE``
+    slices per ``gnfingerprint`` run."""
+    slice_paths = sorted(glob.glob(os.path.join(src_dir, '*.wav')))
+    found_tracks = []
+    for i in range(0, len(slice_paths), config.FINGERPRINT_BATCH_SIZE):
+        for found_track in fingerprint_files(slice_paths[i:i + config.FINGERPRINT_BATCH_SIZE]):
+            if found_track is not None:
+                found_tracks.append(found_track)
+    return found_tracks
+
+
+def trim_tracks(found_tracks, filter_count=None):
+    """Only include results of they appear more than ``filter_count`` times,
+    which defaults to ``config.FILTER_COUNT``."""
+    if filter_count is None:
+        filter_count = config.FILTER_COUNT
+    results = [record for (record, count) in collections.Counter(found_tracks).most_common() if count > filter_count]
+    return results
+
+
+def print_tracks(tracks):
+    for record in tracks:
+        print ' - '.join(record)
 
 
 def create_rdio_playlist(playlist_name, playlist_description, found_rdio_tracks):
@@ -257,34 +359,63 @@ def create_rdio_playlist(playlist_name, playlist_description, found_rdio_tracks)
     r.raise_for_status()
 
     print r.json()
+    return r.json()
+
+
+def episode_dir(src_url):
+    """The work directory of ``src_url`` under ``config.DOWNLOAD_DIR``.
+
+    It is the same for every run, so an interrupted download resumes."""
+    download_dir = config.DOWNLOAD_DIR or os.path.join(tempfile.gettempdir(), 'podmapper-downloads')
+    dst_dir = os.path.join(download_dir, os.path.splitext(
+        os.path.basename(downloader.episode_path(src_url, '')))[0])
+    if not os.path.isdir(dst_dir):
+        os.makedirs(dst_dir)
+    return dst_dir
+
 
+def process_episode(src_url):
+    """Downloads and fingerprints one episode; returns (name, tracks).
+
+    The episode's work directory is only removed once it succeeds."""
 
-def main():
     logger = logging.getLogger(__name__)
 
-    dest_dir_base = tempfile.mkdtemp(prefix='podmapper-')
-    dest_dir_slice = tempfile.mkdtemp(prefix='slices-', dir=dest_dir_base)
+    dest_dir_base = episode_dir(src_url)
+    logger.info('Work dir %s', dest_dir_base)
 
-    logger.info('Temp dir %s', dest_dir_base)
+    dest_dir_slice = tempfile.mkdtemp(prefix='slices-', dir=dest_dir_base)
     logger.info('Temp slice dir %s', dest_dir_slice)
 
-    downloaded_file_path = download_podcast(config.SRC_MP3, dest_dir_base)
-    converted_file_path = convert_podcast(downloaded_file_path, dest_dir_base)
+    downloaded_file_path, converted_file_path = download_and_convert(src_url, dest_dir_base)
     split_wave_file(converted_file_path, dest_dir_slice)
     found_tracks = fingerprint_directory(dest_dir_slice)
     results = trim_tracks(found_tracks)
+    print_tracks(results)
 
     catalog_name, _ = os.path.splitext(os.path.basename(downloaded_file_path))
-    catalog_ticket = update_catalog(catalog_name, results)
-    check_catalog_status(catalog_name, catalog_ticket)
-    found_rdio_tracks = dump_catalog(catalog_name)
-
-    playlist_name = catalog_name
-    playlist_description = 'Created via Podmapper.\SRC_MP3=%s\nWAVE_SAMPLE_SIZE=%s\nFILTER_COUNT=%s' % (config.SRC_MP3, config.WAVE_SAMPLE_SIZE, config.FILTER_COUNT)
-    create_rdio_playlist(playlist_name, playlist_description, found_rdio_tracks)
 
     shutil.rmtree(dest_dir_base)
 
+    return catalog_name, results
+
+
+def main(src_urls):
+    """Maps each episode in ``src_urls`` to an Rdio playlist.
+
+    While one episode is being fingerprinted, the catalog stage works on the
+    ones before it."""
+    import catalog_stage
+
+    stage = catalog_stage.CatalogStage()
+    try:
+        for src_url in src_urls:
+            catalog_name, results = process_episode(src_url)
+            playlist_description = 'Created via Podmapper.\nSRC_MP3=%s\nWAVE_SAMPLE_SIZE=%s\nFILTER_COUNT=%s' % (src_url, config.WAVE_SAMPLE_SIZE, config.FILTER_COUNT)
+            stage.submit(catalog_name, results, playlist_description)
+    finally:
+        stage.close()
+
 
 if __name__ == '__main__':
     logging.basicConfig(level=logging.INFO)
@@ -295,4 +426,4 @@ if __name__ == '__main__':
     requests_log.setLevel(logging.WARN)
     requests_log.propagate = True
 
-    main()
+    main(sys.argv[1:] or [config.SRC_MP3])
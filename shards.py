@@ -0,0 +1,506 @@
+"""Sharded episode processing over a shared work directory.
+
+A coordinator splits episodes, or window ranges of long episodes, into shards.
+Any number of workers, on one or many hosts sharing the directory, claim
+shards through lease files, fingerprint them and record the results.
+
+    python shards.py plan WORK_DIR episode.wav http://example.com/episode.mp3
+    python shards.py work WORK_DIR --processes 4
+    python shards.py status WORK_DIR
+    python shards.py collect WORK_DIR
+
+Layout of WORK_DIR:
+
+    episodes/             WAV files downloaded and converted by ``plan``
+    shards/<id>.json      shard description: episode, WAV path, start, end
+    leases/<id>.<gen>     lease generation ``gen`` of a shard
+    results/<id>.json     identified tracks of a finished shard
+    failures/<id>.json    failed attempts at a shard and the last error
+    journal/<worker>.log  completion journal of each worker
+
+Leases are claimed by creating ``leases/<id>.<gen>`` with O_EXCL, so only one
+worker wins each generation. The holder renews it by touching the file. A lease
+whose mtime is older than ``config.SHARD_LEASE_TIMEOUT`` is reclaimed by
+creating the next generation; its previous holder notices the newer file on
+its next renewal and abandons the shard. Lease ages are measured against the
+mtime of a file the worker has just touched in ``leases/``, so hosts whose
+clocks disagree still agree on them. Releasing a lease keeps its file, with its
+mtime set to 0, so generations only ever grow. Results are written with
+write-and-rename, so a shard is finished exactly when its result file exists.
+
+A shard whose processing raises is recorded in ``failures/`` and released for
+another attempt; after ``config.SHARD_MAX_ATTEMPTS`` failed attempts it is no
+longer claimed, and ``status`` reports it as failed.
+"""
+import argparse
+import collections
+import errno
+import json
+import logging
+import multiprocessing
+import os
+import os.path
+import shutil
+import socket
+import sys
+import tempfile
+import threading
+import time
+import wave
+
+import config
+import podmapper
+
+
+SUBDIRS = ('episodes', 'shards', 'leases', 'results', 'failures', 'journal')
+
+
+class LeaseLost(Exception):
+    """Raised when another worker reclaimed the shard being processed."""
+
+
+def _write_json_atomic(path, data):
+    """Writes ``data`` to ``path`` via a temp file in the same directory."""
+    fd, tmp_path = tempfile.mkstemp(prefix='.tmp-', dir=os.path.dirname(path))
+    with os.fdopen(fd, 'w') as fp:
+        json.dump(data, fp)
+        fp.flush()
+        os.fsync(fp.fileno())
+    os.rename(tmp_path, path)
+
+
+def _read_json(path):
+    with open(path) as fp:
+        return json.load(fp)
+
+
+def worker_name():
+    return '%s-%d' % (socket.gethostname(), os.getpid())
+
+
+class WorkDir(object):
+    """Paths and queries over a shared work directory."""
+
+    def __init__(self, path):
+        self.path = os.path.abspath(path)
+
+    def join(self, *parts):
+        return os.path.join(self.path, *parts)
+
+    def create(self):
+        for subdir in SUBDIRS:
+            if not os.path.isdir(self.join(subdir)):
+                os.makedirs(self.join(subdir))
+
+    def shard_ids(self):
+        return sorted(os.path.splitext(name)[0]
+                      for name in os.listdir(self.join('shards'))
+                      if name.endswith('.json'))
+
+    def shard(self, shard_id):
+        return _read_json(self.join('shards', '%s.json' % shard_id))
+
+    def result_path(self, shard_id):
+        return self.join('results', '%s.json' % shard_id)
+
+    def is_done(self, shard_id):
+        return os.path.exists(self.result_path(shard_id))
+
+    def failure_path(self, shard_id):
+        return self.join('failures', '%s.json' % shard_id)
+
+    def failed_attempts(self, shard_id):
+        try:
+            return _read_json(self.failure_path(shard_id))['attempts']
+        except (IOError, OSError, ValueError, KeyError):
+            return 0
+
+    def has_failed(self, shard_id):
+        """True once ``shard_id`` failed ``config.SHARD_MAX_ATTEMPTS`` times."""
+        return self.failed_attempts(shard_id) >= config.SHARD_MAX_ATTEMPTS
+
+    def lease_generations(self, shard_id):
+        """Returns the existing lease generations of ``shard_id``, newest last."""
+        prefix = '%s.' % shard_id
+        generations = []
+        for name in os.listdir(self.join('leases')):
+            if name.startswith(prefix) and name[len(prefix):].isdigit():
+                generations.append(int(name[len(prefix):]))
+        return sorted(generations)
+
+    def lease_path(self, shard_id, generation):
+        return self.join('leases', '%s.%d' % (shard_id, generation))
+
+    def now(self):
+        """The current time of the file system the leases live on."""
+        path = self.join('leases', '.clock-%s' % worker_name())
+        with open(path, 'a'):
+            pass
+        os.utime(path, None)
+        return os.path.getmtime(path)
+
+    def scan(self):
+        """Lists each directory once; returns (unfinished shard ids, {shard id:
+        lease generations, newest last})."""
+        done = set(os.path.splitext(name)[0] for name in os.listdir(self.join('results'))
+                   if name.endswith('.json'))
+        failed = set(os.path.splitext(name)[0] for name in os.listdir(self.join('failures'))
+                     if name.endswith('.json')) if os.path.isdir(self.join('failures')) else set()
+        failed = set(shard_id for shard_id in failed if self.has_failed(shard_id))
+        generations = collections.defaultdict(list)
+        for name in os.listdir(self.join('leases')):
+            shard_id, _, generation = name.rpartition('.')
+            if shard_id and generation.isdigit():
+                generations[shard_id].append(int(generation))
+        for shard_generations in generations.values():
+            shard_generations.sort()
+        pending = [shard_id for shard_id in self.shard_ids()
+                   if shard_id not in done and shard_id not in failed]
+        return pending, generations
+
+    def wave_path(self, shard):
+        """Shard WAV paths inside the work dir are stored relative to it."""
+        return os.path.join(self.path, shard['wave_path'])
+
+
+class Lease(object):
+    """A claimed shard; renews itself from a background thread."""
+
+    def __init__(self, work_dir, shard_id, generation):
+        self.work_dir = work_dir
+        self.shard_id = shard_id
+        self.generation = generation
+        self.path = work_dir.lease_path(shard_id, generation)
+        self.lost = False
+        self._stop = threading.Event()
+        self._thread = threading.Thread(target=self._renew)
+        self._thread.daemon = True
+
+    @classmethod
+    def claim(cls, work_dir, shard_id, owner, generations=None, now=None):
+        """Returns a Lease on ``shard_id``, or None if someone else holds it.
+
+        ``generations`` and ``now`` may come from ``WorkDir.scan`` and
+        ``WorkDir.now`` to claim from one listing."""
+        logger = logging.getLogger('shard-lease')
+
+        if generations is None:
+            generations = work_dir.lease_generations(shard_id)
+        if generations:
+            current = generations[-1]
+            try:
+                mtime = os.path.getmtime(work_dir.lease_path(shard_id, current))
+            except OSError:
+                return None  # replaced under us, try again later
+            if mtime != 0:
+                age = (work_dir.now() if now is None else now) - mtime
+                if age < config.SHARD_LEASE_TIMEOUT:
+                    return None
+                logger.info('Reclaiming shard %s from expired lease %d (%ds old)',
+                            shard_id, current, age)
+            generation = current + 1
+        else:
+            generation = 0
+
+        try:
+            fd = os.open(work_dir.lease_path(shard_id, generation),
+                         os.O_WRONLY | os.O_CREAT | os.O_EXCL, 0644)
+        except OSError as e:
+            if e.errno == errno.EEXIST:
+                return None
+            raise
+        os.write(fd, json.dumps({'owner': owner, 'claimed': time.time()}))
+        os.close(fd)
+
+        lease = cls(work_dir, shard_id, generation)
+        lease._thread.start()
+        return lease
+
+    def _renew(self):
+        interval = config.SHARD_LEASE_TIMEOUT / 4.0
+        while not self._stop.wait(interval):
+            try:
+                self.check()
+            except LeaseLost:
+                return
+            try:
+                os.utime(self.path, None)
+            except OSError:
+                self.lost = True
+
+    def check(self):
+        """Raises LeaseLost if a newer generation of this lease exists."""
+        generations = self.work_dir.lease_generations(self.shard_id)
+        if generations and generations[-1] > self.generation:
+            self.lost = True
+        if self.lost:
+            raise LeaseLost(self.shard_id)
+
+    def release(self):
+        """Stops renewing and removes older generations. This one is kept with
+        its mtime set to 0, free to claim, so the next claim takes a newer
+        generation and a stalled older holder can still tell it lost."""
+        self._stop.set()
+        self._thread.join()
+        for generation in self.work_dir.lease_generations(self.shard_id):
+            try:
+                if generation < self.generation:
+                    os.unlink(self.work_dir.lease_path(self.shard_id, generation))
+                elif generation == self.generation:
+                    os.utime(self.path, (0, 0))
+            except OSError:
+                pass
+
+
+def plan(work_dir, episodes, shard_seconds=None):
+    """Writes shard descriptions for ``episodes`` (WAV paths or MP3 URLs)."""
+
+    logger = logging.getLogger('shard-planner')
+
+    if shard_seconds is None:
+        shard_seconds = config.SHARD_SECONDS
+    # Keep shard boundaries on window starts so sharding doesn't change the slices
+    shard_seconds = max(1, int(shard_seconds // config.WAVE_HOP_SIZE)) * config.WAVE_HOP_SIZE
+
+    work_dir.create()
+    episode_dir = work_dir.join('episodes')
+
+    count = 0
+    for episode in episodes:
+        if episode.startswith('http://') or episode.startswith('https://'):
+            downloaded_path, wave_path = podmapper.download_and_convert(episode, episode_dir)
+            os.unlink(downloaded_path)
+        else:
+            wave_path = os.path.abspath(episode)
+
+        episode_name, _ = os.path.splitext(os.path.basename(wave_path))
+        track = wave.open(wave_path, 'r')
+        total_length = track.getnframes() / track.getframerate()
+        track.close()
+
+        if wave_path.startswith(work_dir.path + os.sep):
+            wave_path = os.path.relpath(wave_path, work_dir.path)
+
+        start = 0
+        while start < total_length:
+            end = min(start + shard_seconds, total_length)
+            shard_id = '%s-%05d_%05d' % (episode_name, start, end)
+            _write_json_atomic(work_dir.join('shards', '%s.json' % shard_id), {
+                'id': shard_id,
+                'episode': episode_name,
+                'source': episode,
+                'wave_path': wave_path,
+                'start': start,
+                'end': end,
+            })
+            count += 1
+            start = end
+
+        logger.info('Planned %s (%ss) from %s', episode_name, total_length, episode)
+
+    logger.info('Planned %d shards in %s', count, work_dir.path)
+    return count
+
+
+def process_shard(work_dir, shard, lease):
+    """Fingerprints the window range of ``shard``; returns the found tracks."""
+
+    slice_dir = tempfile.mkdtemp(prefix='shard-slices-')
+    try:
+        podmapper.split_wave_file(work_dir.wave_path(shard), slice_dir,
+                                  start=shard['start'], end=shard['end'])
+        slice_paths = [os.path.join(slice_dir, name) for name in sorted(os.listdir(slice_dir))]
+        found_tracks = []
+        for i in range(0, len(slice_paths), config.FINGERPRINT_BATCH_SIZE):
+            lease.check()
+            for found_track in podmapper.fingerprint_files(
+                    slice_paths[i:i + config.FINGERPRINT_BATCH_SIZE]):
+                if found_track is not None:
+                    found_tracks.append(found_track)
+        return found_tracks
+    finally:
+        shutil.rmtree(slice_dir)
+
+
+def work(work_dir, max_idle=0):
+    """Claims and processes shards until none are left.
+
+    With ``max_idle`` > 0, keeps polling that many seconds for shards whose
+    leases are held by others, so crashed workers' shards get picked up."""
+
+    logger = logging.getLogger('shard-worker')
+
+    owner = worker_name()
+    if not os.path.isdir(work_dir.join('failures')):
+        os.makedirs(work_dir.join('failures'))  # work dirs planned before it existed
+    journal_path = work_dir.join('journal', '%s.log' % owner)
+    processed = 0
+    failed_here = set()  # retried only once nothing else is left for this worker
+    idle_since = None
+
+    while True:
+        pending, generations = work_dir.scan()
+        if not pending:
+            break
+        pending = [shard_id for shard_id in pending if shard_id not in failed_here] or pending
+
+        lease = None
+        now = work_dir.now()
+        for shard_id in pending:
+            lease = Lease.claim(work_dir, shard_id, owner, generations.get(shard_id, []), now)
+            if lease is not None:
+                break
+
+        if lease is None:
+            if idle_since is None:
+                idle_since = time.time()
+            if time.time() - idle_since >= max_idle:
+                break
+            time.sleep(min(config.SHARD_LEASE_TIMEOUT / 4.0, max_idle))
+            continue
+        idle_since = None
+
+        shard = work_dir.shard(lease.shard_id)
+        started = time.time()
+        try:
+            found_tracks = process_shard(work_dir, shard, lease)
+            lease.check()
+            _write_json_atomic(work_dir.result_path(shard['id']), {
+                'id': shard['id'],
+                'episode': shard['episode'],
+                'worker': owner,
+                'generation': lease.generation,
+                'found_tracks': found_tracks,
+            })
+        except LeaseLost:
+            logger.warn('Lost lease on shard %s, abandoning it', shard['id'])
+            continue
+        except Exception as e:
+            # Recorded while the lease is held, so no other worker updates the count meanwhile
+            attempts = work_dir.failed_attempts(shard['id']) + 1
+            logger.exception('Shard %s failed (attempt %d of %d)', shard['id'], attempts,
+                             config.SHARD_MAX_ATTEMPTS)
+            _write_json_atomic(work_dir.failure_path(shard['id']), {
+                'id': shard['id'],
+                'attempts': attempts,
+                'worker': owner,
+                'error': '%s: %s' % (type(e).__name__, e),
+            })
+            _journal(journal_path, 'failed %s %d %d' % (shard['id'], lease.generation, attempts))
+            failed_here.add(shard['id'])
+            continue
+        finally:
+            lease.release()
+
+        _journal(journal_path, 'done %s %d %.3f' % (
+            shard['id'], lease.generation, time.time() - started))
+
+        processed += 1
+        logger.info('Finished shard %s in %.1fs', shard['id'], time.time() - started)
+
+    logger.info('Worker %s processed %d shards', owner, processed)
+    return processed
+
+
+def _journal(journal_path, entry):
+    with open(journal_path, 'a') as journal:
+        journal.write('%s %s\n' % (time.strftime('%Y-%m-%dT%H:%M:%S'), entry))
+        journal.flush()
+        os.fsync(journal.fileno())
+
+
+def _work_process(path, max_idle):
+    logging.basicConfig(level=logging.INFO)
+    work(WorkDir(path), max_idle)
+
+
+def status(work_dir):
+    """Returns counts of done, failed, leased and pending shards."""
+    counts = collections.Counter()
+    pending, generations = work_dir.scan()
+    pending = set(pending)
+    for shard_id in work_dir.shard_ids():
+        if work_dir.is_done(shard_id):
+            counts['done'] += 1
+        elif shard_id not in pending:
+            counts['failed'] += 1
+        elif generations.get(shard_id) and os.path.getmtime(
+                work_dir.lease_path(shard_id, generations[shard_id][-1])) != 0:
+            counts['leased'] += 1
+        else:
+            counts['pending'] += 1
+    return counts
+
+
+def collect(work_dir):
+    """Merges shard results per episode; returns {episode: trimmed tracks}."""
+
+    logger = logging.getLogger('shard-collector')
+
+    found_tracks = collections.defaultdict(list)
+    missing = collections.Counter()
+    for shard_id in work_dir.shard_ids():
+        shard = work_dir.shard(shard_id)
+        if work_dir.is_done(shard_id):
+            result = _read_json(work_dir.result_path(shard_id))
+            found_tracks[shard['episode']].extend(tuple(t) for t in result['found_tracks'])
+        else:
+            missing[shard['episode']] += 1
+
+    results = {}
+    for episode in sorted(set(found_tracks) | set(missing)):
+        if missing[episode]:
+            logger.warn('Episode %s has %d unfinished shards', episode, missing[episode])
+            continue
+        print episode
+        results[episode] = podmapper.trim_tracks(found_tracks[episode])
+        podmapper.print_tracks(results[episode])
+        print
+    return results
+
+
+def main(argv):
+    parser = argparse.ArgumentParser(description=__doc__.split('\n')[0])
+    subparsers = parser.add_subparsers(dest='command')
+
+    plan_parser = subparsers.add_parser('plan', help='split episodes into shards')
+    plan_parser.add_argument('work_dir')
+    plan_parser.add_argument('episodes', nargs='+', help='WAV paths or MP3 URLs')
+    plan_parser.add_argument('--shard-seconds', type=int, default=None)
+
+    work_parser = subparsers.add_parser('work', help='process shards')
+    work_parser.add_argument('work_dir')
+    work_parser.add_argument('--processes', type=int, default=1)
+    work_parser.add_argument('--max-idle', type=int, default=0,
+                             help='seconds to wait for leases held by others')
+
+    for command in ('status', 'collect'):
+        subparser = subparsers.add_parser(command)
+        subparser.add_argument('work_dir')
+
+    args = parser.parse_args(argv)
+    work_dir = WorkDir(args.work_dir)
+
+    if args.command == 'plan':
+        plan(work_dir, args.episodes, args.shard_seconds)
+    elif args.command == 'work':
+        processes = [multiprocessing.Process(target=_work_process,
+                                             args=(work_dir.path, args.max_idle))
+                     for _ in range(args.processes)]
+        for process in processes:
+            process.start()
+        for process in processes:
+            process.join()
+    elif args.command == 'status':
+        for key, value in sorted(status(work_dir).items()):
+            print key, value
+    elif args.command == 'collect':
+        collect(work_dir)
+
+    return 0
+
+
+if __name__ == '__main__':
+    logging.basicConfig(level=logging.INFO)
+    logging.getLogger('spliter').setLevel(logging.WARN)
+    sys.exit(main(sys.argv[1:]))
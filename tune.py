@@ -0,0 +1,192 @@
+"""Window size / hop / threshold tuner.
+
+Sweeps the window length, hop and quiet-window pre-filter used by
+``split_wave_file`` and the vote threshold used by ``trim_tracks`` over a set
+of labeled episodes. Every point is measured for queries issued, wall time and
+precision/recall, and the Pareto-optimal configurations (no other point has
+fewer queries, less time and at least the same precision and recall) are
+printed.
+
+Labeled episodes come from a manifest and are fingerprinted with the real
+``gnfingerprint``, so tuning them costs Gracenote queries:
+
+    [{"wav": "episode.wav", "tracks": [["Artist", "Album", "Title"], ...]}, ...]
+
+    python tune.py --manifest labeled.json --windows 6 10 15 --hops 5 10
+
+Without a manifest, synthetic episodes from ``benchmark.py`` are used with
+its stand-in backend:
+
+    python tune.py --synthetic 3 --minutes 30
+"""
+import argparse
+import collections
+import glob
+import itertools
+import json
+import logging
+import os
+import os.path
+import shutil
+import sys
+import tempfile
+import time
+
+import benchmark
+import podmapper
+
+
+class Episode(object):
+
+    def __init__(self, wav_path, tracks):
+        self.wav_path = wav_path
+        self.tracks = set(tuple(track) for track in tracks)
+
+
+def load_manifest(path):
+    with open(path) as fp:
+        manifest = json.load(fp)
+    base_dir = os.path.dirname(os.path.abspath(path))
+    return [Episode(os.path.join(base_dir, entry['wav']), entry['tracks'])
+            for entry in manifest]
+
+
+def synthetic_episodes(work_dir, count, minutes, num_tracks, seed):
+    """Generates ``count`` episodes sharing one track set; returns (episodes, backend)."""
+    episodes = []
+    tracks = benchmark.make_tracks(num_tracks, seed)
+    for i in range(count):
+        segments = benchmark.plan_episode(tracks, minutes, seed + i)
+        wav_path = os.path.join(work_dir, 'episode-%d.wav' % i)
+        benchmark.write_episode(wav_path, segments, seed + i)
+        episodes.append(Episode(wav_path, benchmark.played_tracks(segments)))
+    return episodes, benchmark.StandInBackend(tracks)
+
+
+def measure(episodes, fingerprint_directory, window, hop, min_rms):
+    """Splits and fingerprints every episode with one window configuration.
+
+    ``fingerprint_directory(slice_dir)`` returns the tracks found in a
+    directory of slices, like ``podmapper.fingerprint_directory`` which the
+    pipeline uses, so the time measured is what the pipeline would spend.
+    Returns (queries, wall seconds, [found tracks of each episode])."""
+    queries = 0
+    found = []
+    started = time.time()
+    for episode in episodes:
+        slice_dir = tempfile.mkdtemp(prefix='tune-slices-')
+        try:
+            queries += podmapper.split_wave_file(episode.wav_path, slice_dir, window,
+                                                 hop=hop, min_rms=min_rms)
+            found.append(fingerprint_directory(slice_dir))
+        finally:
+            shutil.rmtree(slice_dir)
+    return queries, time.time() - started, found
+
+
+def score(episodes, found, filter_count):
+    """Micro-averaged precision and recall over all episodes."""
+    hits = identified = expected = 0
+    for episode, found_tracks in zip(episodes, found):
+        results = set(podmapper.trim_tracks(found_tracks, filter_count))
+        hits += len(results & episode.tracks)
+        identified += len(results)
+        expected += len(episode.tracks)
+    precision = float(hits) / identified if identified else 1.0
+    recall = float(hits) / expected if expected else 1.0
+    return precision, recall
+
+
+def dominates(a, b):
+    """True if point ``a`` is at least as good as ``b`` everywhere and better somewhere."""
+    at_least = (a['queries'] <= b['queries'] and a['seconds'] <= b['seconds']
+                and a['precision'] >= b['precision'] and a['recall'] >= b['recall'])
+    better = (a['queries'] < b['queries'] or a['seconds'] < b['seconds']
+              or a['precision'] > b['precision'] or a['recall'] > b['recall'])
+    return at_least and better
+
+
+def pareto_front(points):
+    return [p for p in points if not any(dominates(q, p) for q in points)]
+
+
+def sweep(episodes, fingerprint_directory, windows, hops, min_rmses, filter_counts):
+    """Measures every configuration; the vote threshold is applied afterwards
+    since it doesn't change which windows are queried."""
+
+    logger = logging.getLogger('tuner')
+
+    points = []
+    for window, hop, min_rms in itertools.product(windows, hops, min_rmses):
+        if hop > window:
+            continue  # would leave gaps between windows
+        queries, seconds, found = measure(episodes, fingerprint_directory, window, hop, min_rms)
+        for filter_count in filter_counts:
+            precision, recall = score(episodes, found, filter_count)
+            point = collections.OrderedDict([
+                ('window', window), ('hop', hop), ('min_rms', min_rms),
+                ('filter_count', filter_count), ('queries', queries),
+                ('seconds', round(seconds, 2)), ('precision', round(precision, 3)),
+                ('recall', round(recall, 3)),
+            ])
+            logger.info('%s', ' '.join('%s=%s' % item for item in point.items()))
+            points.append(point)
+    return points
+
+
+def main(argv):
+    parser = argparse.ArgumentParser(description=__doc__.split('\n')[0])
+    parser.add_argument('--manifest', help='JSON list of labeled episodes')
+    parser.add_argument('--synthetic', type=int, default=2,
+                        help='number of synthetic episodes when there is no manifest')
+    parser.add_argument('--minutes', type=int, default=20)
+    parser.add_argument('--tracks', type=int, default=20)
+    parser.add_argument('--seed', type=int, default=1)
+    parser.add_argument('--windows', type=int, nargs='+', default=[5, 10, 15],
+                        help='window lengths in whole seconds')
+    parser.add_argument('--hops', type=float, nargs='+', default=[5, 10, 15],
+                        help='hops in seconds')
+    parser.add_argument('--min-rms', type=int, nargs='+', default=[0, 500])
+    parser.add_argument('--filter-counts', type=int, nargs='+', default=[0, 1, 2, 3])
+    parser.add_argument('--json', help='also write all points and the front to this file')
+    args = parser.parse_args(argv)
+
+    work_dir = tempfile.mkdtemp(prefix='podmapper-tune-')
+    try:
+        if args.manifest:
+            episodes = load_manifest(args.manifest)
+            fingerprint_directory = podmapper.fingerprint_directory
+        else:
+            episodes, backend = synthetic_episodes(work_dir, args.synthetic, args.minutes,
+                                                   args.tracks, args.seed)
+
+            def fingerprint_directory(slice_dir):
+                found_tracks = [backend.identify(slice_path) for slice_path in
+                                sorted(glob.glob(os.path.join(slice_dir, '*.wav')))]
+                return [track for track in found_tracks if track is not None]
+
+        points = sweep(episodes, fingerprint_directory, args.windows, args.hops, args.min_rms,
+                       args.filter_counts)
+    finally:
+        shutil.rmtree(work_dir)
+
+    front = sorted(pareto_front(points), key=lambda p: (p['queries'], -p['recall']))
+
+    columns = points[0].keys() if points else []
+    print 'Pareto-optimal configurations:'
+    print '\t'.join(columns)
+    for point in front:
+        print '\t'.join(str(point[column]) for column in columns)
+
+    if args.json:
+        with open(args.json, 'w') as fp:
+            json.dump({'points': points, 'pareto': front}, fp, indent=2)
+
+    return 0
+
+
+if __name__ == '__main__':
+    logging.basicConfig(level=logging.INFO)
+    logging.getLogger('spliter').setLevel(logging.WARN)
+    logging.getLogger('bench-generator').setLevel(logging.WARN)
+    sys.exit(main(sys.argv[1:]))